@@ -0,0 +1,83 @@
+#ifndef AABB_H
+#define AABB_H
+
+#include "RTWeekend.h"
+
+class AABB {
+public:
+    Interval x, y, z;
+
+    AABB() {} // Default AABB is empty, since intervals are empty by default
+
+    AABB(const Interval& x, const Interval& y, const Interval& z) : x(x), y(y), z(z) {}
+
+    AABB(const Point3& a, const Point3& b) {
+        // Treat the two points as extrema of the box, so they don't need to be in a particular order
+        x = a[0] <= b[0] ? Interval(a[0], b[0]) : Interval(b[0], a[0]);
+        y = a[1] <= b[1] ? Interval(a[1], b[1]) : Interval(b[1], a[1]);
+        z = a[2] <= b[2] ? Interval(a[2], b[2]) : Interval(b[2], a[2]);
+    }
+
+    AABB(const AABB& a, const AABB& b) : x(a.x, b.x), y(a.y, b.y), z(a.z, b.z) {}
+
+    const Interval& AxisInterval(int n) const {
+        if (n == 1) return y;
+        if (n == 2) return z;
+        return x;
+    }
+
+    bool IsEmpty() const {
+        return x.min > x.max || y.min > y.max || z.min > z.max;
+    }
+
+    Point3 Centroid() const {
+        return Point3(0.5 * (x.min + x.max), 0.5 * (y.min + y.max), 0.5 * (z.min + z.max));
+    }
+
+    int LongestAxis() const {
+        if (x.Size() > y.Size())
+            return x.Size() > z.Size() ? 0 : 2;
+        return y.Size() > z.Size() ? 1 : 2;
+    }
+
+    double SurfaceArea() const {
+        if (IsEmpty()) return 0;
+        double dx = x.Size(), dy = y.Size(), dz = z.Size();
+        return 2 * (dx * dy + dy * dz + dz * dx);
+    }
+
+    // Slab test with a precomputed reciprocal direction. On a hit, 'entry' receives the distance
+    // at which the ray enters the box (clipped to rayT).
+    bool Hit(const Point3& origin, const Vector3& inverseDirection, const Interval& rayT, double& entry) const {
+        double tMin = rayT.min;
+        double tMax = rayT.max;
+
+        for (int axis = 0; axis < 3; axis++) {
+            const Interval& slab = AxisInterval(axis);
+            double t0 = (slab.min - origin[axis]) * inverseDirection[axis];
+            double t1 = (slab.max - origin[axis]) * inverseDirection[axis];
+            if (t0 > t1) std::swap(t0, t1);
+
+            tMin = t0 > tMin ? t0 : tMin;
+            tMax = t1 < tMax ? t1 : tMax;
+            if (tMax < tMin) return false;
+        }
+
+        entry = tMin;
+        return true;
+    }
+
+    bool Hit(const Ray& ray, const Interval& rayT) const {
+        const Vector3& direction = ray.Direction();
+        Vector3 inverseDirection(1 / direction.x(), 1 / direction.y(), 1 / direction.z());
+        double entry;
+        return Hit(ray.Origin(), inverseDirection, rayT, entry);
+    }
+
+    static const AABB empty, universe;
+};
+
+const AABB AABB::empty = AABB(Interval::empty, Interval::empty, Interval::empty);
+const AABB AABB::universe = AABB(Interval::universe, Interval::universe, Interval::universe);
+
+#endif
@@ -0,0 +1,290 @@
+#ifndef ACCUMULATION_BUFFER_H
+#define ACCUMULATION_BUFFER_H
+
+#include "Framebuffer.h"
+
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <string>
+#include <vector>
+
+// Per-pixel means of the denoiser's guide features, and the variance of each pixel's mean
+// luminance. Depth is stored in all three channels so it can be written like any image.
+struct FeatureImages {
+    Framebuffer albedo;
+    Framebuffer normal;
+    Framebuffer depth;
+    std::vector<float> variance;
+};
+
+// What a checkpoint's samples depend on besides the image size: the seed every sample's random
+// stream is derived from, the scene and view they were traced in, and the settings that decide
+// each sample's value. Sobol and stratified sample indices also depend on samplesPerPixel.
+struct CheckpointSettings {
+    uint64_t seed = 0;
+    uint64_t scene = 0;
+    int32_t samplesPerPixel = 0;
+    int32_t sampler = 0;
+    int32_t maxDepth = 0;
+    int32_t rouletteDepth = 0;
+    int32_t skyLight = 0;
+
+    bool operator==(const CheckpointSettings&) const = default;
+};
+
+// Running per-pixel sample sums for progressive rendering. Samples are added one at a time in
+// sample-index order, so the totals don't depend on how the samples were split into passes
+// and a resumed render reproduces an uninterrupted one exactly. Each pixel also tracks the
+// mean and variance of its sample luminance (Welford's method) for adaptive sampling, and
+// optionally the sums of per-sample features for denoising.
+class AccumulationBuffer {
+public:
+    void Reset(int newWidth, int newHeight, bool withFeatures = false) {
+        width = newWidth;
+        height = newHeight;
+        sums.assign(PixelCount() * 3, 0.0f);
+        sampleCounts.assign(PixelCount(), 0);
+        luminanceMeans.assign(PixelCount(), 0.0f);
+        luminanceM2s.assign(PixelCount(), 0.0f);
+        featureSums.assign(withFeatures ? PixelCount() * featureChannels : 0, 0.0f);
+    }
+
+    bool HasFeatures() const { return !featureSums.empty(); }
+
+    int Width() const { return width; }
+    int Height() const { return height; }
+    size_t PixelCount() const { return size_t(width) * height; }
+
+    void AddSample(int x, int y, const Color& color) {
+        size_t pixel = size_t(y) * width + x;
+        float* sum = &sums[pixel * 3];
+        sum[0] += float(color.x());
+        sum[1] += float(color.y());
+        sum[2] += float(color.z());
+        uint32_t count = ++sampleCounts[pixel];
+
+        float luminance = float(0.2126 * color.x() + 0.7152 * color.y() + 0.0722 * color.z());
+        float delta = luminance - luminanceMeans[pixel];
+        luminanceMeans[pixel] += delta / count;
+        luminanceM2s[pixel] += delta * (luminance - luminanceMeans[pixel]);
+    }
+
+    // Adds the features of the sample last passed to AddSample for this pixel
+    void AddFeatures(int x, int y, const Color& albedo, const Vector3& normal, double depth) {
+        float* sum = &featureSums[(size_t(y) * width + x) * featureChannels];
+        sum[0] += float(albedo.x());
+        sum[1] += float(albedo.y());
+        sum[2] += float(albedo.z());
+        sum[3] += float(normal.x());
+        sum[4] += float(normal.y());
+        sum[5] += float(normal.z());
+        sum[6] += float(depth);
+    }
+
+    // Adds the samples of a smaller buffer covering the region whose top left is (x0, y0), as
+    // if they had been added here after the ones already taken. Merging into pixels with no
+    // samples reproduces the other buffer exactly.
+    void Merge(const AccumulationBuffer& other, int x0, int y0) {
+        for (int y = 0; y < other.height; y++) {
+            for (int x = 0; x < other.width; x++) {
+                size_t from = size_t(y) * other.width + x;
+                size_t to = size_t(y0 + y) * width + x0 + x;
+                uint32_t otherCount = other.sampleCounts[from];
+                if (otherCount == 0) continue;
+
+                for (int channel = 0; channel < 3; channel++) sums[to * 3 + channel] += other.sums[from * 3 + channel];
+                for (size_t channel = 0; channel < featureChannels && HasFeatures(); channel++)
+                    featureSums[to * featureChannels + channel] += other.featureSums[from * featureChannels + channel];
+
+                // Chan et al.'s pairwise update of the luminance mean and M2
+                uint32_t count = sampleCounts[to] + otherCount;
+                float delta = other.luminanceMeans[from] - luminanceMeans[to];
+                if (sampleCounts[to] == 0) {
+                    luminanceMeans[to] = other.luminanceMeans[from];
+                    luminanceM2s[to] = other.luminanceM2s[from];
+                }
+                else {
+                    luminanceMeans[to] += delta * otherCount / count;
+                    luminanceM2s[to] += other.luminanceM2s[from] + delta * delta * sampleCounts[to] * otherCount / count;
+                }
+                sampleCounts[to] = count;
+            }
+        }
+    }
+
+    uint32_t SampleCount(int x, int y) const { return sampleCounts[size_t(y) * width + x]; }
+    uint32_t SampleCount(size_t pixel) const { return sampleCounts[pixel]; }
+
+    uint64_t TotalSamples() const {
+        uint64_t total = 0;
+        for (uint32_t count : sampleCounts) total += count;
+        return total;
+    }
+
+    // Half-width of the 95% confidence interval of the pixel's mean luminance, relative to that
+    // mean. Dark pixels are measured against a small floor so they don't demand endless samples.
+    double RelativeError(size_t pixel) const {
+        uint32_t count = sampleCounts[pixel];
+        if (count < 2) return infinity;
+
+        double variance = std::max(0.0f, luminanceM2s[pixel]) / (count - 1);
+        double halfWidth = 1.96 * std::sqrt(variance / count);
+        return halfWidth / std::max(double(luminanceMeans[pixel]), 0.01);
+    }
+
+    // Writes the per-pixel mean into the framebuffer
+    void Resolve(Framebuffer& image) const {
+        image.Resize(width, height);
+        float* out = image.Data();
+        for (size_t pixel = 0; pixel < sampleCounts.size(); pixel++) {
+            float scale = sampleCounts[pixel] > 0 ? 1.0f / sampleCounts[pixel] : 0.0f;
+            for (int channel = 0; channel < 3; channel++)
+                out[pixel * 3 + channel] = sums[pixel * 3 + channel] * scale;
+        }
+    }
+
+    void ResolveFeatures(FeatureImages& features) const {
+        features.albedo.Resize(width, height);
+        features.normal.Resize(width, height);
+        features.depth.Resize(width, height);
+        features.variance.resize(sampleCounts.size());
+        for (size_t pixel = 0; pixel < sampleCounts.size(); pixel++) {
+            uint32_t count = sampleCounts[pixel];
+            features.variance[pixel] = count > 1 ? std::max(0.0f, luminanceM2s[pixel]) / (float(count - 1) * count) : 0.0f;
+            if (featureSums.empty()) continue;
+
+            float scale = count > 0 ? 1.0f / count : 0.0f;
+            const float* sum = &featureSums[pixel * featureChannels];
+            for (int channel = 0; channel < 3; channel++) {
+                features.albedo.Data()[pixel * 3 + channel] = sum[channel] * scale;
+                features.normal.Data()[pixel * 3 + channel] = sum[3 + channel] * scale;
+                features.depth.Data()[pixel * 3 + channel] = sum[6] * scale;
+            }
+        }
+    }
+
+    // The raw contents: float RGB sums, uint32 sample counts, the luminance means and M2 terms,
+    // then the feature sums if there are any. ReadData expects a buffer Reset to the same size
+    // and features as the one written.
+    void WriteData(std::ostream& out) const {
+        WriteArray(out, sums);
+        WriteArray(out, sampleCounts);
+        WriteArray(out, luminanceMeans);
+        WriteArray(out, luminanceM2s);
+        WriteArray(out, featureSums);
+    }
+
+    // Bytes WriteData writes for a buffer of this size
+    static size_t DataSize(int width, int height, bool withFeatures) {
+        size_t pixels = size_t(width) * height;
+        return pixels * (3 * sizeof(float) + sizeof(uint32_t) + 2 * sizeof(float) + (withFeatures ? featureChannels * sizeof(float) : 0));
+    }
+
+    bool ReadData(std::istream& in) {
+        ReadArray(in, sums);
+        ReadArray(in, sampleCounts);
+        ReadArray(in, luminanceMeans);
+        ReadArray(in, luminanceM2s);
+        ReadArray(in, featureSums);
+        return bool(in);
+    }
+
+    // Checkpoint layout: a header holding the image size and settings, then WriteData
+    bool SaveCheckpoint(const std::string& path, const CheckpointSettings& settings) const {
+        // Write next to the target and rename, so a crash mid-write never clobbers the last good file
+        std::string temporaryPath = path + ".tmp";
+        {
+            std::ofstream out(temporaryPath, std::ios::binary);
+            // Zeroed whole and filled in by field, as the header is written as raw bytes and
+            // mustn't carry stale padding (copying 'settings' whole would bring the caller's)
+            CheckpointHeader header;
+            std::memset(static_cast<void*>(&header), 0, sizeof(header)); // Trivially copyable, despite the settings' initializers
+            header.magic = checkpointMagic;
+            header.version = checkpointVersion;
+            header.width = width;
+            header.height = height;
+            header.features = HasFeatures();
+            header.settings.seed = settings.seed;
+            header.settings.scene = settings.scene;
+            header.settings.samplesPerPixel = settings.samplesPerPixel;
+            header.settings.sampler = settings.sampler;
+            header.settings.maxDepth = settings.maxDepth;
+            header.settings.rouletteDepth = settings.rouletteDepth;
+            header.settings.skyLight = settings.skyLight;
+            out.write(reinterpret_cast<const char*>(&header), sizeof(header));
+            WriteData(out);
+            if (!out) return false;
+        }
+
+        std::error_code error;
+        std::filesystem::rename(temporaryPath, path, error);
+        return !error;
+    }
+
+    // Loads a checkpoint for an image of the given size and settings, with features if the
+    // buffer was Reset with them. Returns false, leaving the buffer untouched, if there is no
+    // checkpoint or it can't be resumed; 'error' says why in the second case.
+    bool LoadCheckpoint(const std::string& path, int expectedWidth, int expectedHeight, const CheckpointSettings& settings, std::string& error) {
+        error.clear();
+        std::ifstream in(path, std::ios::binary);
+        if (!in) return false;
+
+        CheckpointHeader header;
+        in.read(reinterpret_cast<char*>(&header), sizeof(header));
+        if (!in || header.magic != checkpointMagic || header.version != checkpointVersion)
+            error = "not a checkpoint of this version";
+        else if (header.width != expectedWidth || header.height != expectedHeight)
+            error = "taken at a different image size";
+        else if (bool(header.features) != HasFeatures())
+            error = bool(header.features) ? "taken with denoising features" : "taken without denoising features";
+        else if (!(header.settings == settings))
+            error = "taken of a different scene or with different render settings";
+        if (!error.empty()) return false;
+
+        AccumulationBuffer loaded;
+        loaded.Reset(header.width, header.height, header.features);
+        if (!loaded.ReadData(in)) {
+            error = "truncated";
+            return false;
+        }
+        *this = std::move(loaded);
+        return true;
+    }
+
+private:
+    struct CheckpointHeader {
+        uint32_t magic;
+        uint32_t version;
+        int32_t width;
+        int32_t height;
+        uint32_t features;
+        CheckpointSettings settings;
+    };
+
+    static constexpr uint32_t checkpointMagic = 0x4b435452; // "RTCK"
+    static constexpr uint32_t checkpointVersion = 4;
+    static constexpr size_t featureChannels = 7; // Albedo RGB, normal XYZ, depth
+
+    int width = 0;
+    int height = 0;
+    std::vector<float> sums;
+    std::vector<uint32_t> sampleCounts;
+    std::vector<float> luminanceMeans;
+    std::vector<float> luminanceM2s;
+    std::vector<float> featureSums;
+
+    template <typename T>
+    static void WriteArray(std::ostream& out, const std::vector<T>& values) {
+        out.write(reinterpret_cast<const char*>(values.data()), std::streamsize(values.size() * sizeof(T)));
+    }
+
+    template <typename T>
+    static void ReadArray(std::istream& in, std::vector<T>& values) {
+        in.read(reinterpret_cast<char*>(values.data()), std::streamsize(values.size() * sizeof(T)));
+    }
+};
+
+#endif
@@ -0,0 +1,352 @@
+#ifndef BVH_H
+#define BVH_H
+
+#include "AABB.h"
+#include "Hittable.h"
+#include "HittableList.h"
+#include "Primitive.h"
+#include "ThreadPool.h"
+
+#include <algorithm>
+#include <cstdint>
+#include <memory>
+#include <vector>
+
+// Flattened BVH node. The first child of an interior node is stored directly after it, so only
+// the second child's index is kept. Leaves point at a contiguous run of primitives instead.
+struct BVHNode {
+    AABB bounds;
+    uint32_t offset;          // Second child (interior) or first primitive (leaf)
+    uint16_t primitiveCount;  // 0 for interior nodes
+    uint8_t axis;             // Split axis, used to visit the nearer child first
+
+    bool IsLeaf() const { return primitiveCount > 0; }
+};
+
+// Top-down binned SAH builder shared by every BVH in the tracer. It only looks at primitive
+// bounds, so it works the same for spheres, triangles or whole sub-scenes.
+class BVHBuilder {
+public:
+    static constexpr int binCount = 16;
+    static constexpr int maxLeafSize = 4;
+    static constexpr int maxDepth = 64;
+    // Oversized leaves past maxDepth are still halved, which can add up to 16 more levels
+    static constexpr int maxStackSize = maxDepth + 16;
+
+    // Builds a tree over 'bounds'. On return 'order' maps every leaf slot to the index of the
+    // primitive that belongs there, so callers can reorder their primitives to match.
+    static std::vector<BVHNode> Build(const std::vector<AABB>& bounds, std::vector<uint32_t>& order, ThreadPool* pool = nullptr) {
+        BVHBuilder builder(bounds, order, pool);
+        std::vector<BVHNode> nodes;
+        if (bounds.empty()) return nodes;
+
+        std::unique_ptr<BuildNode> root = builder.BuildRange(0, uint32_t(bounds.size()), 0);
+        nodes.reserve(root->subtreeSize);
+        Flatten(*root, nodes);
+        return nodes;
+    }
+
+private:
+    struct BuildNode {
+        AABB bounds;
+        std::unique_ptr<BuildNode> children[2];
+        uint32_t begin = 0, count = 0;
+        uint32_t subtreeSize = 1;
+        int axis = 0;
+    };
+
+    struct Bin {
+        AABB bounds;
+        uint32_t count = 0;
+    };
+
+    struct BinGrid {
+        Bin bins[3][binCount];
+    };
+
+    // Subtrees larger than this are built on the pool; below it task overhead dominates
+    static constexpr uint32_t parallelBuildThreshold = 16 * 1024;
+    // Nodes larger than this also bin their primitives in parallel
+    static constexpr uint32_t parallelBinThreshold = 256 * 1024;
+
+    const std::vector<AABB>& bounds;
+    std::vector<uint32_t>& order;
+    std::vector<Point3> centroids;
+    ThreadPool* pool;
+
+    BVHBuilder(const std::vector<AABB>& bounds, std::vector<uint32_t>& order, ThreadPool* pool)
+        : bounds(bounds), order(order), pool(pool) {
+        order.resize(bounds.size());
+        centroids.resize(bounds.size());
+        for (uint32_t i = 0; i < bounds.size(); i++) {
+            order[i] = i;
+            centroids[i] = bounds[i].Centroid();
+        }
+    }
+
+    std::unique_ptr<BuildNode> BuildRange(uint32_t begin, uint32_t end, int depth) {
+        auto node = std::make_unique<BuildNode>();
+        uint32_t count = end - begin;
+
+        AABB nodeBounds, centroidBounds;
+        ComputeBounds(begin, end, nodeBounds, centroidBounds);
+        node->bounds = nodeBounds;
+
+        int axis = 0;
+        uint32_t mid = 0;
+        bool leaf = count == 1 || (depth >= maxDepth && count <= UINT16_MAX);
+        if (!leaf && !FindSplit(begin, end, nodeBounds, centroidBounds, axis, mid)) {
+            if (count <= maxLeafSize) {
+                leaf = true;
+            }
+            else {
+                // Every centroid coincides, so no plane separates them; split the range in half
+                axis = 0;
+                mid = begin + count / 2;
+            }
+        }
+
+        if (leaf) {
+            node->begin = begin;
+            node->count = count;
+            return node;
+        }
+        node->axis = axis;
+
+        if (pool && count > parallelBuildThreshold) {
+            TaskGroup group;
+            pool->Submit(group, [&] { node->children[0] = BuildRange(begin, mid, depth + 1); });
+            node->children[1] = BuildRange(mid, end, depth + 1);
+            pool->Wait(group);
+        }
+        else {
+            node->children[0] = BuildRange(begin, mid, depth + 1);
+            node->children[1] = BuildRange(mid, end, depth + 1);
+        }
+
+        node->subtreeSize = 1 + node->children[0]->subtreeSize + node->children[1]->subtreeSize;
+        return node;
+    }
+
+    void ComputeBounds(uint32_t begin, uint32_t end, AABB& nodeBounds, AABB& centroidBounds) const {
+        for (uint32_t i = begin; i < end; i++) {
+            uint32_t index = order[i];
+            nodeBounds = AABB(nodeBounds, bounds[index]);
+            centroidBounds = AABB(centroidBounds, AABB(centroids[index], centroids[index]));
+        }
+    }
+
+    static int BinIndex(double centroid, double minimum, double scale) {
+        int bin = int((centroid - minimum) * scale);
+        return bin < 0 ? 0 : (bin >= binCount ? binCount - 1 : bin);
+    }
+
+    void FillBins(uint32_t begin, uint32_t end, const AABB& centroidBounds, BinGrid& grid) const {
+        for (int axis = 0; axis < 3; axis++) {
+            const Interval& extent = centroidBounds.AxisInterval(axis);
+            if (extent.Size() <= 0) continue;
+            double scale = binCount / extent.Size();
+
+            for (uint32_t i = begin; i < end; i++) {
+                uint32_t index = order[i];
+                Bin& bin = grid.bins[axis][BinIndex(centroids[index][axis], extent.min, scale)];
+                bin.count++;
+                bin.bounds = AABB(bin.bounds, bounds[index]);
+            }
+        }
+    }
+
+    // Evaluates the SAH at every bin boundary on every axis. Returns false if a leaf is cheaper.
+    bool FindSplit(uint32_t begin, uint32_t end, const AABB& nodeBounds, const AABB& centroidBounds, int& bestAxis, uint32_t& mid) {
+        uint32_t count = end - begin;
+        BinGrid grid;
+
+        if (pool && count > parallelBinThreshold) {
+            // Bin fixed-size chunks independently, then merge
+            int chunkCount = pool->ThreadCount() * 4;
+            std::vector<BinGrid> chunkGrids(chunkCount);
+            pool->ParallelFor(chunkCount, [&](int chunk) {
+                uint32_t chunkBegin = begin + uint32_t(uint64_t(count) * chunk / chunkCount);
+                uint32_t chunkEnd = begin + uint32_t(uint64_t(count) * (chunk + 1) / chunkCount);
+                FillBins(chunkBegin, chunkEnd, centroidBounds, chunkGrids[chunk]);
+            });
+            for (int chunk = 0; chunk < chunkCount; chunk++) {
+                for (int axis = 0; axis < 3; axis++) {
+                    for (int b = 0; b < binCount; b++) {
+                        const Bin& source = chunkGrids[chunk].bins[axis][b];
+                        Bin& target = grid.bins[axis][b];
+                        target.count += source.count;
+                        target.bounds = AABB(target.bounds, source.bounds);
+                    }
+                }
+            }
+        }
+        else {
+            FillBins(begin, end, centroidBounds, grid);
+        }
+
+        // Cost of a split relative to a leaf, with traversal and intersection both costing 1
+        double bestCost = infinity;
+        int bestSplit = -1;
+        bestAxis = -1;
+        for (int axis = 0; axis < 3; axis++) {
+            if (centroidBounds.AxisInterval(axis).Size() <= 0) continue;
+
+            // Sweep from the right to collect the area and count of everything past each boundary
+            double rightArea[binCount];
+            uint32_t rightCount[binCount];
+            AABB accumulated;
+            uint32_t accumulatedCount = 0;
+            for (int b = binCount - 1; b > 0; b--) {
+                accumulated = AABB(accumulated, grid.bins[axis][b].bounds);
+                accumulatedCount += grid.bins[axis][b].count;
+                rightArea[b] = accumulated.SurfaceArea();
+                rightCount[b] = accumulatedCount;
+            }
+
+            accumulated = AABB();
+            accumulatedCount = 0;
+            for (int b = 0; b < binCount - 1; b++) {
+                accumulated = AABB(accumulated, grid.bins[axis][b].bounds);
+                accumulatedCount += grid.bins[axis][b].count;
+                if (accumulatedCount == 0 || rightCount[b + 1] == 0) continue;
+
+                double cost = accumulated.SurfaceArea() * accumulatedCount + rightArea[b + 1] * rightCount[b + 1];
+                if (cost < bestCost) {
+                    bestCost = cost;
+                    bestAxis = axis;
+                    bestSplit = b;
+                }
+            }
+        }
+
+        if (bestAxis < 0) return false; // Every centroid coincides
+
+        double parentArea = nodeBounds.SurfaceArea();
+        double splitCost = 1 + (parentArea > 0 ? bestCost / parentArea : 0);
+        if (count <= maxLeafSize && splitCost >= count) return false;
+
+        const Interval& extent = centroidBounds.AxisInterval(bestAxis);
+        double scale = binCount / extent.Size();
+        auto first = order.begin() + begin;
+        auto middle = std::partition(first, order.begin() + end, [&](uint32_t index) {
+            return BinIndex(centroids[index][bestAxis], extent.min, scale) <= bestSplit;
+        });
+        mid = uint32_t(middle - order.begin());
+        return true;
+    }
+
+    static void Flatten(const BuildNode& node, std::vector<BVHNode>& nodes) {
+        size_t index = nodes.size();
+        nodes.push_back({ node.bounds, node.begin, uint16_t(node.count), uint8_t(node.axis) });
+        if (node.count > 0) return;
+
+        Flatten(*node.children[0], nodes);
+        nodes[index].offset = uint32_t(nodes.size());
+        Flatten(*node.children[1], nodes);
+    }
+};
+
+// Walks a flattened tree front to back. 'hitLeaf(first, count, rayT)' tests a leaf's primitives,
+// shrinking rayT.max to the closest hit, and returns whether it found one.
+template <typename LeafTest>
+bool TraverseBVH(const std::vector<BVHNode>& nodes, const Ray& ray, Interval rayT, LeafTest&& hitLeaf) {
+    if (nodes.empty()) return false;
+
+    const Point3& origin = ray.Origin();
+    const Vector3& direction = ray.Direction();
+    Vector3 inverseDirection(1 / direction.x(), 1 / direction.y(), 1 / direction.z());
+    bool directionNegative[3] = { direction.x() < 0, direction.y() < 0, direction.z() < 0 };
+
+    bool hitAnything = false;
+    uint32_t stack[BVHBuilder::maxStackSize];
+    int stackSize = 0;
+    uint32_t current = 0;
+
+    while (true) {
+        TRACE_COUNT(nodesVisited);
+        const BVHNode& node = nodes[current];
+        double entry;
+        if (node.bounds.Hit(origin, inverseDirection, rayT, entry)) {
+            if (node.IsLeaf()) {
+                if (hitLeaf(node.offset, uint32_t(node.primitiveCount), rayT)) hitAnything = true;
+            }
+            else {
+                // Descend into the child on the ray's side of the split first
+                if (directionNegative[node.axis]) {
+                    stack[stackSize++] = current + 1;
+                    current = node.offset;
+                }
+                else {
+                    stack[stackSize++] = node.offset;
+                    current = current + 1;
+                }
+                continue;
+            }
+        }
+
+        if (stackSize == 0) break;
+        current = stack[--stackSize];
+    }
+
+    return hitAnything;
+}
+
+// Drop-in replacement for a HittableList: same Hit interface, but O(log N) per ray.
+class BVH : public Hittable {
+public:
+    BVH(const HittableList& list, ThreadPool* pool = nullptr, Dispatch dispatch = Dispatch::ClosedWorld)
+        : BVH(list.objects, pool, dispatch) {}
+
+    BVH(const std::vector<shared_ptr<Hittable>>& sourceObjects, ThreadPool* pool = nullptr, Dispatch dispatch = Dispatch::ClosedWorld) {
+        std::vector<AABB> bounds;
+        bounds.reserve(sourceObjects.size());
+        for (const auto& object : sourceObjects)
+            bounds.push_back(object->BoundingBox());
+
+        // Large scenes get a temporary pool when the caller didn't provide one
+        std::unique_ptr<ThreadPool> ownedPool;
+        if (!pool && sourceObjects.size() > 16 * 1024) {
+            ownedPool = std::make_unique<ThreadPool>();
+            pool = ownedPool.get();
+        }
+
+        std::vector<uint32_t> order;
+        nodes = BVHBuilder::Build(bounds, order, pool);
+
+        primitives.reserve(order.size());
+        for (uint32_t index : order)
+            primitives.emplace_back(sourceObjects[index], dispatch);
+    }
+
+    bool Hit(const Ray& ray, Interval rayT, HitRecord& record) const override {
+        TRACE_COUNT(hitCalls);
+        return TraverseBVH(nodes, ray, rayT, [&](uint32_t first, uint32_t count, Interval& leafT) {
+            bool hitAnything = false;
+            for (uint32_t i = first; i < first + count; i++) {
+                if (primitives[i].Hit(ray, leafT, record)) {
+                    hitAnything = true;
+                    leafT.max = record.t;
+                }
+            }
+            return hitAnything;
+        });
+    }
+
+    void CollectLights(LightList& lights) const override {
+        for (const Primitive& primitive : primitives)
+            primitive.CollectLights(lights);
+    }
+
+    AABB BoundingBox() const override {
+        return nodes.empty() ? AABB() : nodes[0].bounds;
+    }
+
+    size_t NodeCount() const { return nodes.size(); }
+
+private:
+    std::vector<BVHNode> nodes;
+    std::vector<Primitive> primitives;
+};
+
+#endif
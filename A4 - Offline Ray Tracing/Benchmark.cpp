@@ -0,0 +1,354 @@
+#include "RTWeekend.h"
+#include "Camera.h"
+#include "HittableList.h"
+#include "ImageIO.h"
+#include "ImageMetrics.h"
+#include "SceneFile.h"
+#include "Scenes.h"
+#include "WideBVH.h"
+
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <functional>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <vector>
+
+#if defined(_WIN32)
+#define NOMINMAX
+#include <windows.h>
+#include <psapi.h>
+#pragma comment(lib, "psapi.lib")
+#else
+#include <sys/resource.h>
+#endif
+
+// Renders fixed, seeded scenes at several thread counts and reports ray throughput, build
+// time and peak memory, as a table and optionally as JSON for tracking regressions.
+//
+//	Benchmark [--scenes main,spheres10k,spheres1m] [--threads 1,2,4] [--width 320] [--spp 16]
+//	          [--depth 50] [--sampler independent|stratified|sobol|bluenoise] [--adaptive on|off]
+//	          [--denoise on|off] [--json results.json]
+//	Benchmark --converge seconds [--reference image.pfm] [--reference-spp 4096] [...] --scenes name
+//
+// Any other name in --scenes is loaded as a scene file, with its load time counted as build
+// time. Image settings in the file stay in effect for the scenes after it.
+//
+// Ray throughput doesn't show whether a sampler, adaptive sampling or the denoiser reach a
+// given quality sooner, so --converge instead renders the one scene at 1, 2, 4, ... samples per
+// pixel, on the largest thread count, until a render takes longer than the given seconds, and
+// reports each render's time and its error against the reference (see ImageMetrics.h). The
+// reference is rendered with the plain settings at --reference-spp and a different seed and
+// saved, if the file doesn't exist yet; by default it is <scene>.reference.pfm.
+
+struct BenchmarkRun {
+	int threads;
+	RenderStatistics statistics;
+};
+
+// One render of a convergence curve, timed from the start of Render to the finished image
+struct ConvergencePoint {
+	int samplesPerPixel;
+	double seconds;
+	double rmse;
+	double relMSE;
+	double flip;
+};
+
+struct BenchmarkResult {
+	string name;
+	size_t objectCount;
+	double buildSeconds;
+	size_t peakMemoryBytes;
+	vector<BenchmarkRun> runs;
+	vector<ConvergencePoint> convergence;
+};
+
+// A scene's objects and what rays are traced through
+struct BenchmarkScene {
+	HittableList list;
+	vector<shared_ptr<Hittable>> objects; // What scene files and generated fields load into
+	unique_ptr<Hittable> bvh;
+
+	const Hittable& World() const { return bvh ? *bvh : static_cast<const Hittable&>(list); }
+};
+
+// --sampler names, in SamplerType order
+static const string SamplerNames[] = { "independent", "stratified", "sobol", "bluenoise" };
+
+// Peak resident memory of the whole process so far
+static size_t PeakMemoryBytes() {
+#if defined(_WIN32)
+	PROCESS_MEMORY_COUNTERS counters;
+	if (!GetProcessMemoryInfo(GetCurrentProcess(), &counters, sizeof(counters))) return 0;
+	return counters.PeakWorkingSetSize;
+#else
+	rusage usage;
+	if (getrusage(RUSAGE_SELF, &usage) != 0) return 0;
+#if defined(__APPLE__)
+	return size_t(usage.ru_maxrss);
+#else
+	return size_t(usage.ru_maxrss) * 1024;
+#endif
+#endif
+}
+
+static vector<string> Split(const string& list) {
+	vector<string> items;
+	stringstream stream(list);
+	for (string item; getline(stream, item, ',');) {
+		if (!item.empty()) items.push_back(item);
+	}
+	return items;
+}
+
+static double Seconds(chrono::steady_clock::time_point start) {
+	return chrono::duration<double>(chrono::steady_clock::now() - start).count();
+}
+
+// Creates the objects and whatever acceleration structure the scene uses, which is what build
+// time covers
+static bool BuildScene(const string& name, int threads, Camera& camera, BenchmarkScene& scene, BenchmarkResult& result) {
+	result = { name, 0, 0, 0, {}, {} };
+	ThreadPool buildPool(threads);
+
+	auto start = chrono::steady_clock::now();
+	if (name == "main") {
+		MainScene(scene.list, camera);
+		result.objectCount = scene.list.objects.size();
+	}
+	else {
+		if (name == "spheres10k" || name == "spheres1m") {
+			scene.objects = RandomSpheres(name == "spheres1m" ? 1000000 : 10000, 1, camera);
+		}
+		else if (string error; !SceneLoader().Load(name, scene.objects, camera, error)) {
+			cerr << error << "\n";
+			return false;
+		}
+		result.objectCount = scene.objects.size();
+		scene.bvh = make_unique<WideBVH>(scene.objects, &buildPool);
+	}
+	result.buildSeconds = Seconds(start);
+	return true;
+}
+
+static bool RunScene(const string& name, const vector<int>& threadCounts, Camera& camera, BenchmarkResult& result) {
+	BenchmarkScene scene;
+	if (!BuildScene(name, threadCounts.back(), camera, scene, result)) return false;
+	const Hittable& world = scene.World();
+
+	for (int threads : threadCounts) {
+		camera.threadCount = threads;
+		camera.Render(world);
+		result.runs.push_back({ threads, camera.Statistics() });
+	}
+	result.peakMemoryBytes = PeakMemoryBytes();
+	return true;
+}
+
+// Loads the reference, or renders and saves it if there is no such file. The camera's sampling
+// strategy is left out so every strategy is measured against the same image.
+static bool LoadReference(const string& path, int referenceSpp, Camera& camera, const Hittable& world, Framebuffer& reference) {
+	string error;
+	if (filesystem::exists(path)) {
+		if (ReadImage(path, reference, error)) return true;
+		cerr << error << "\n";
+		return false;
+	}
+
+	int samplesPerPixel = camera.samplesPerPixel;
+	SamplerType samplerType = camera.samplerType;
+	bool adaptiveSampling = camera.adaptiveSampling, denoise = camera.denoise;
+	uint64_t seed = camera.seed;
+	camera.samplesPerPixel = referenceSpp;
+	camera.samplerType = SamplerType::Sobol;
+	camera.adaptiveSampling = false;
+	camera.denoise = false;
+	camera.seed = seed ^ 0x5eed5eed5eed5eedull; // Test renders mustn't share its samples
+	camera.writeOutput = true;
+	camera.outputPath = path;
+	clog << "Rendering the reference at " << referenceSpp << " samples per pixel\n";
+	camera.Render(world);
+	reference = camera.Image();
+
+	camera.writeOutput = false;
+	camera.outputPath.clear();
+	camera.samplesPerPixel = samplesPerPixel;
+	camera.samplerType = samplerType;
+	camera.adaptiveSampling = adaptiveSampling;
+	camera.denoise = denoise;
+	camera.seed = seed;
+	return true;
+}
+
+static bool RunConvergence(const string& name, int threads, double maxSeconds, string referencePath, int referenceSpp,
+	Camera& camera, BenchmarkResult& result) {
+	BenchmarkScene scene;
+	if (!BuildScene(name, threads, camera, scene, result)) return false;
+	const Hittable& world = scene.World();
+	camera.threadCount = threads;
+
+	if (referencePath.empty()) referencePath = filesystem::path(name).replace_extension().string() + ".reference.pfm";
+	Framebuffer reference;
+	if (!LoadReference(referencePath, referenceSpp, camera, world, reference)) return false;
+
+	int samplesPerPixel = camera.samplesPerPixel;
+	for (int spp = 1;; spp *= 2) {
+		camera.samplesPerPixel = spp;
+		auto start = chrono::steady_clock::now();
+		camera.Render(world);
+		double seconds = Seconds(start);
+
+		const Framebuffer& image = camera.Image();
+		if (image.Width() != reference.Width() || image.Height() != reference.Height()) {
+			cerr << referencePath << " is " << reference.Width() << "x" << reference.Height() << ", the render "
+				<< image.Width() << "x" << image.Height() << "\n";
+			return false;
+		}
+		result.convergence.push_back({ spp, seconds, ImageMetrics::RMSE(image, reference), ImageMetrics::RelMSE(image, reference),
+			ImageMetrics::FLIPError(image, reference) });
+		if (seconds > maxSeconds) break;
+	}
+	camera.samplesPerPixel = samplesPerPixel;
+	result.peakMemoryBytes = PeakMemoryBytes();
+	return true;
+}
+
+static void PrintResult(const BenchmarkResult& result) {
+	printf("\n%s: %zu objects, built in %.1f ms, peak memory %.1f MB\n", result.name.c_str(), result.objectCount,
+		result.buildSeconds * 1000, result.peakMemoryBytes / 1048576.0);
+	if (result.runs.empty()) {
+		printf("      spp   seconds         RMSE       relMSE     FLIP\n");
+		for (const ConvergencePoint& point : result.convergence)
+			printf("  %7d  %8.3f  %11.6f  %11.6f  %7.4f\n", point.samplesPerPixel, point.seconds, point.rmse, point.relMSE, point.flip);
+		return;
+	}
+	printf("  threads  seconds  primary Mrays/s  secondary Mrays/s  shadow Mrays/s  total Mrays/s  speedup\n");
+	double baseline = result.runs.front().statistics.seconds;
+	for (const BenchmarkRun& run : result.runs) {
+		const RenderStatistics& s = run.statistics;
+		printf("  %7d  %7.3f  %15.3f  %17.3f  %14.3f  %13.3f  %7.2f\n", run.threads, s.seconds,
+			s.primaryRays / s.seconds * 1e-6, s.secondaryRays / s.seconds * 1e-6, s.shadowRays / s.seconds * 1e-6,
+			s.TotalRays() / s.seconds * 1e-6, baseline / s.seconds);
+	}
+}
+
+static bool WriteJson(const string& path, const vector<BenchmarkResult>& results, const Camera& camera) {
+	ofstream out(path);
+	out << "{\n";
+	out << "  \"hardwareThreads\": " << thread::hardware_concurrency() << ",\n";
+	out << "  \"settings\": { \"width\": " << camera.imageWidth << ", \"aspectRatio\": " << camera.aspectRatio
+		<< ", \"samplesPerPixel\": " << camera.samplesPerPixel << ", \"maxDepth\": " << camera.maxDepth
+		<< ", \"seed\": " << camera.seed << ", \"sampler\": \"" << SamplerNames[int(camera.samplerType)]
+		<< "\", \"adaptive\": " << (camera.adaptiveSampling ? "true" : "false") << ", \"denoise\": "
+		<< (camera.denoise ? "true" : "false") << " },\n";
+	out << "  \"scenes\": [\n";
+	for (size_t i = 0; i < results.size(); i++) {
+		const BenchmarkResult& result = results[i];
+		out << "    {\n";
+		out << "      \"name\": \"" << result.name << "\",\n";
+		out << "      \"objects\": " << result.objectCount << ",\n";
+		out << "      \"buildSeconds\": " << result.buildSeconds << ",\n";
+		out << "      \"peakMemoryBytes\": " << result.peakMemoryBytes << ",\n";
+		out << "      \"runs\": [\n";
+		for (size_t j = 0; j < result.runs.size(); j++) {
+			const RenderStatistics& s = result.runs[j].statistics;
+			out << "        { \"threads\": " << result.runs[j].threads << ", \"seconds\": " << s.seconds
+				<< ", \"primaryRays\": " << s.primaryRays << ", \"secondaryRays\": " << s.secondaryRays
+				<< ", \"shadowRays\": " << s.shadowRays << ", \"primaryRaysPerSecond\": " << s.primaryRays / s.seconds
+				<< ", \"secondaryRaysPerSecond\": " << s.secondaryRays / s.seconds
+				<< ", \"shadowRaysPerSecond\": " << s.shadowRays / s.seconds
+				<< ", \"totalRaysPerSecond\": " << s.TotalRays() / s.seconds << " }" << (j + 1 < result.runs.size() ? "," : "") << "\n";
+		}
+		out << "      ]" << (result.convergence.empty() ? "" : ",") << "\n";
+		if (!result.convergence.empty()) {
+			out << "      \"convergence\": [\n";
+			for (size_t j = 0; j < result.convergence.size(); j++) {
+				const ConvergencePoint& point = result.convergence[j];
+				out << "        { \"samplesPerPixel\": " << point.samplesPerPixel << ", \"seconds\": " << point.seconds
+					<< ", \"rmse\": " << point.rmse << ", \"relMSE\": " << point.relMSE << ", \"flip\": " << point.flip << " }"
+					<< (j + 1 < result.convergence.size() ? "," : "") << "\n";
+			}
+			out << "      ]\n";
+		}
+		out << "    }" << (i + 1 < results.size() ? "," : "") << "\n";
+	}
+	out << "  ]\n}\n";
+	return bool(out);
+}
+
+int main(int argc, char** argv) {
+	vector<string> scenes = { "main", "spheres10k", "spheres1m" };
+	vector<int> threadCounts;
+	string jsonPath, referencePath;
+	double convergeSeconds = 0;
+	int referenceSpp = 4096;
+
+	Camera camera;
+	camera.aspectRatio = 16.0 / 9.0;
+	camera.imageWidth = 320;
+	camera.samplesPerPixel = 16;
+	camera.maxDepth = 50;
+	camera.writeOutput = false;
+
+	for (int i = 1; i + 1 < argc; i += 2) {
+		string option = argv[i], value = argv[i + 1];
+		if (option == "--scenes") scenes = Split(value);
+		else if (option == "--threads") for (const string& count : Split(value)) threadCounts.push_back(max(1, stoi(count)));
+		else if (option == "--width") camera.imageWidth = stoi(value);
+		else if (option == "--spp") camera.samplesPerPixel = stoi(value);
+		else if (option == "--depth") camera.maxDepth = stoi(value);
+		else if (option == "--json") jsonPath = value;
+		else if (option == "--converge") convergeSeconds = stod(value);
+		else if (option == "--reference") referencePath = value;
+		else if (option == "--reference-spp") referenceSpp = stoi(value);
+		else if (option == "--adaptive") camera.adaptiveSampling = value == "on";
+		else if (option == "--denoise") camera.denoise = value == "on";
+		else if (option == "--sampler") {
+			auto found = find(begin(SamplerNames), end(SamplerNames), value);
+			if (found == end(SamplerNames)) {
+				cerr << "Unknown sampler " << value << "\n";
+				return 1;
+			}
+			camera.samplerType = SamplerType(found - begin(SamplerNames));
+		}
+		else {
+			cerr << "Unknown option " << option << "\n";
+			return 1;
+		}
+	}
+
+	// Powers of two up to the hardware thread count, then the count itself
+	if (threadCounts.empty()) {
+		int hardware = max(1, int(thread::hardware_concurrency()));
+		for (int count = 1; count < hardware; count *= 2) threadCounts.push_back(count);
+		threadCounts.push_back(hardware);
+	}
+	sort(threadCounts.begin(), threadCounts.end());
+
+	vector<BenchmarkResult> results;
+	if (convergeSeconds > 0) {
+		if (scenes.size() != 1) {
+			cerr << "--converge measures one scene against its reference; pass a single name to --scenes\n";
+			return 1;
+		}
+		results.emplace_back();
+		if (!RunConvergence(scenes[0], threadCounts.back(), convergeSeconds, referencePath, referenceSpp, camera, results.back())) return 1;
+		PrintResult(results.back());
+		scenes.clear();
+	}
+	for (const string& scene : scenes) {
+		results.emplace_back();
+		if (!RunScene(scene, threadCounts, camera, results.back())) return 1;
+		PrintResult(results.back());
+	}
+
+	if (!jsonPath.empty() && !WriteJson(jsonPath, results, camera)) {
+		cerr << "Could not write " << jsonPath << "\n";
+		return 1;
+	}
+}
@@ -1,11 +1,39 @@
 #ifndef CAMERA_H
 #define CAMERA_H
 
+#include "AccumulationBuffer.h"
+#include "Denoiser.h"
+#include "Framebuffer.h"
 #include "Hittable.h"
+#include "ImageIO.h"
+#include "LightList.h"
 #include "Material.h"
+#include "MaterialTable.h"
+#include "Sampler.h"
+#include "Statistics.h"
+#include "ThreadPool.h"
+
+#include <atomic>
+#include <bit>
+#include <chrono>
+#include <filesystem>
+#include <mutex>
+#include <string>
+#include <vector>
 
 using namespace std;
 
+// What the last Render traced and how long its sampling passes took
+struct RenderStatistics {
+    uint64_t primaryRays = 0;
+    uint64_t secondaryRays = 0; // Bounces after the camera ray
+    uint64_t shadowRays = 0;    // Light visibility tests
+    double seconds = 0;
+    int passes = 0;             // Sampling passes added to the image
+
+    uint64_t TotalRays() const { return primaryRays + secondaryRays + shadowRays; }
+};
+
 class Camera {
 public:
     /* Public Camera Parameters Here */
@@ -13,6 +41,10 @@ public:
     int imageWidth = 100;
     int samplesPerPixel = 10;
     int maxDepth = 10;
+    int rouletteDepth = 5; // Bounces before Russian roulette may end a path
+    SamplerType samplerType = SamplerType::Sobol;
+    bool skyLight = true; // Off for scenes lit only by emissive materials
+    Dispatch materialDispatch = Dispatch::ClosedWorld;
     double verticalFov = 90;
 
     Point3 lookFrom = Point3(0, 0, 0);
@@ -22,30 +54,319 @@ public:
     double defocusAngle = 0;
     double focusDistance = 10;
 
+    int tileSize = 16;
+    int threadCount = 0; // 0 uses every hardware thread
+    uint64_t seed = 0;   // Renders are reproducible per seed, whatever the thread count
+
+    // Stream mode traces a tile's paths one bounce at a time: every ray of a bounce is sorted by
+    // direction octant and origin Morton code before tracing, so neighbouring rays in the stream
+    // walk the same parts of the BVH. The image is identical to the per-path mode.
+    bool streamMode = false;
+
+    // Format follows the extension (.ppm binary P6, .pfm float, .exr half float).
+    // With no path the image goes to cout as P3 text.
+    string outputPath;
+
+    // Samples are taken in passes of this many per pixel. After a pass the accumulated sums
+    // are checkpointed if checkpointPath is set and checkpointInterval seconds have passed, and
+    // a later Render with the same settings resumes from that checkpoint. The checkpoint is
+    // deleted once the final image has been written. It records the image size, seed, sampling
+    // and path settings, the view and sceneFingerprint, and one that differs in any of them is
+    // ignored and later overwritten. SceneLoader sets sceneFingerprint from the scene file and
+    // the files it loads; scenes built in code leave it to the caller.
+    int samplesPerPass = 16;
+    string checkpointPath;
+    double checkpointInterval = 60;
+    uint64_t sceneFingerprint = 0;
+
+    // Adaptive sampling keeps the same total budget (samplesPerPixel times the pixel count)
+    // but stops sampling a pixel once its luminance confidence interval is within errorTarget
+    // of its mean, spending what is left on the pixels that are still noisy.
+    bool adaptiveSampling = false;
+    int minSamples = 16;
+    int maxSamples = 1024;
+    double errorTarget = 0.05;
+
+    // With a time budget in seconds, Render stops sampling when it is spent, or at the usual
+    // samplesPerPixel budget if that comes first. Each pass after the first is sized from the
+    // last one's time per sample to end within the budget, and is accumulated on the side and
+    // only added to the image once complete: a pass still running at the deadline skips the
+    // tiles it hasn't started and is dropped. Every pixel therefore ends with whole passes, as
+    // planned uniformly or by adaptive sampling, never a biased part of one. The first pass of
+    // one sample per pixel always completes so there is an image. Denoising and writing the
+    // image come after the budget.
+    double timeBudget = 0;
+
+    // Denoising guides: the albedo, normal and depth at each sample's first surface that isn't a
+    // mirror or glass, seen through those with their tint kept in the albedo. writeFeatures saves
+    // them next to the image as <name>.albedo<ext>, <name>.normal<ext> and <name>.depth<ext>
+    // (.pfm keeps negative normals and depths past 1). denoise filters the image with them
+    // before it is written.
+    bool writeFeatures = false;
+    bool denoise = false;
+    Denoiser denoiser;
+
+    // Off to keep the result in memory only, for Image()
+    bool writeOutput = true;
+
+    // In a build with RT_STATISTICS (see Statistics.h), Render prints the trace counters and
+    // per-tile times when it finishes, and writeCostMap saves each pixel's mean traversal work
+    // per sample next to the image as <name>.cost<ext>, in false colour from black through red
+    // and yellow to white at the 99th percentile.
+    bool writeCostMap = false;
+
     void Render(const Hittable& world) {
         Initialize();
+        accumulation.Reset(imageWidth, imageHeight, writeFeatures || denoise);
+#if defined(RT_STATISTICS)
+        TraceCounters::Reset();
+        counters = TraceCounters();
+        pixelWork.assign(accumulation.PixelCount(), 0);
+        pixelPaths.assign(accumulation.PixelCount(), 0);
+        passWork.assign(accumulation.PixelCount(), 0);
+        passPaths.assign(accumulation.PixelCount(), 0);
+#else
+        if (writeCostMap) cerr << "The cost map needs a build with RT_STATISTICS defined\n";
+#endif
+
+        ResumeCheckpoint();
+
+        // Split the image into tiles and let the pool balance them across cores
+        vector<Tile> tiles;
+        for (int y = 0; y < imageHeight; y += tileSize)
+            for (int x = 0; x < imageWidth; x += tileSize)
+                tiles.push_back({ x, y, min(x + tileSize, imageWidth), min(y + tileSize, imageHeight) });
+
+        Prepare(world);
+        ThreadPool pool(threadCount);
+        mutex progressMutex;
+        statistics = RenderStatistics();
+        auto renderStart = chrono::steady_clock::now();
+        lastCheckpoint = chrono::steady_clock::now();
+        vector<uint16_t> plan(accumulation.PixelCount());
+#if defined(RT_STATISTICS)
+        int tilesAcross = (imageWidth + tileSize - 1) / tileSize;
+        tileSeconds.assign(tiles.size(), 0);
+        vector<double> passTileSeconds(tiles.size());
+#endif
+
+        bool timed = timeBudget > 0;
+        AccumulationBuffer passBuffer;
+        double secondsPerSample = 0; // Of the last timed pass; 0 until one has completed
+        bool deadlineReached = false;
+
+        clog << "Rendering " << tiles.size() << " tiles on " << pool.ThreadCount() << " threads\n";
+        for (int pass = 1;; pass++) {
+            uint64_t limit = UINT64_MAX;
+            if (timed) {
+                double remaining = timeBudget - chrono::duration<double>(chrono::steady_clock::now() - renderStart).count();
+                // Aiming a little short, as a pass that overruns the deadline is wasted entirely
+                limit = secondsPerSample > 0 ? uint64_t(fmax(0.0, 0.9 * remaining) / secondsPerSample) : accumulation.PixelCount();
+            }
+            uint64_t planned = PlanPass(plan, limit);
+            if (planned == 0) {
+                deadlineReached = timed && limit < UINT64_MAX && PlanPass(plan, UINT64_MAX) > 0;
+                break;
+            }
+
+            // Tiles where every pixel has converged are skipped entirely
+            vector<Tile> activeTiles;
+            for (const Tile& tile : tiles) {
+                if (TileHasWork(tile, plan)) activeTiles.push_back(tile);
+            }
+            int tilesRemaining = int(activeTiles.size());
+
+            // Timed passes go to passBuffer, which is empty at the start of each
+            AccumulationBuffer& target = timed ? passBuffer : accumulation;
+            if (timed) passBuffer.Reset(imageWidth, imageHeight, accumulation.HasFeatures());
+            bool cancellable = timed && secondsPerSample > 0;
+            atomic<bool> cancelled = false;
+            // Like the samples, a pass's ray counts only count once the pass is merged
+            RenderStatistics passStatistics;
+            auto passStart = chrono::steady_clock::now();
 
-        // Render it
-        cout << "P3\n" << imageWidth << ' ' << imageHeight << "\n255\n";
+            TaskGroup group;
+            for (const Tile& tile : activeTiles) {
+                pool.Submit(group, [&, tile] {
+                    if (cancellable && chrono::duration<double>(chrono::steady_clock::now() - renderStart).count() > timeBudget) {
+                        cancelled = true;
+                        return;
+                    }
+#if defined(RT_STATISTICS)
+                    auto tileStart = chrono::steady_clock::now();
+#endif
+                    RenderStatistics tileStatistics;
+                    // A pixel's sample indices continue from however many it already has
+                    auto samples = [&](uint32_t pixel) { return pair(accumulation.SampleCount(pixel), uint32_t(plan[pixel])); };
+                    TraceTile(tile, world, samples, [&](const PathState& path) { AddPath(path, tileStatistics, target, 0, 0); });
+#if defined(RT_STATISTICS)
+                    // Each tile is only ever rendered by one task per pass
+                    passTileSeconds[size_t(tile.y0 / tileSize) * tilesAcross + tile.x0 / tileSize] = chrono::duration<double>(chrono::steady_clock::now() - tileStart).count();
+#endif
 
-        for (int i = 0; i < imageHeight; i++) {
-            clog << "\rScanlines remaining: " << (imageHeight - i) << " " << flush;
-            for (int j = 0; j < imageWidth; j++) {
-                Color pixelColor(0, 0, 0);
-                for (int sample = 0; sample < samplesPerPixel; sample++) {
-                    Ray ray = GetRay(j, i);
-                    pixelColor += RayColor(ray, maxDepth, world);
+                    lock_guard<mutex> lock(progressMutex);
+                    passStatistics.primaryRays += tileStatistics.primaryRays;
+                    passStatistics.secondaryRays += tileStatistics.secondaryRays;
+                    passStatistics.shadowRays += tileStatistics.shadowRays;
+                    clog << "\rPass " << pass << ", tiles remaining: " << --tilesRemaining << "   " << flush;
+                });
+            }
+            pool.Wait(group);
+
+            if (cancelled) {
+                deadlineReached = true;
+                break;
+            }
+            if (timed) {
+                accumulation.Merge(passBuffer, 0, 0);
+                secondsPerSample = chrono::duration<double>(chrono::steady_clock::now() - passStart).count() / double(planned);
+            }
+            statistics.primaryRays += passStatistics.primaryRays;
+            statistics.secondaryRays += passStatistics.secondaryRays;
+            statistics.shadowRays += passStatistics.shadowRays;
+            statistics.passes++;
+#if defined(RT_STATISTICS)
+            // Its trace counters, tile times and cost-map work likewise
+            counters = TraceCounters::Collect();
+            for (size_t pixel = 0; pixel < pixelWork.size(); pixel++) {
+                pixelWork[pixel] += passWork[pixel];
+                pixelPaths[pixel] += passPaths[pixel];
+            }
+            fill(passWork.begin(), passWork.end(), 0);
+            fill(passPaths.begin(), passPaths.end(), 0);
+            for (size_t index = 0; index < tiles.size(); index++) tileSeconds[index] += passTileSeconds[index];
+            fill(passTileSeconds.begin(), passTileSeconds.end(), 0.0);
+#endif
+
+            auto now = chrono::steady_clock::now();
+            if (!checkpointPath.empty() && chrono::duration<double>(now - lastCheckpoint).count() >= checkpointInterval) {
+                if (!accumulation.SaveCheckpoint(checkpointPath, checkpointSettings))
+                    cerr << "\nCould not write checkpoint " << checkpointPath << "\n";
+                lastCheckpoint = now;
+            }
+        }
+        if (deadlineReached) {
+            clog << "\nTime budget spent after " << statistics.passes << " passes, "
+                << double(accumulation.TotalSamples()) / double(accumulation.PixelCount()) << " samples per pixel";
+        }
+
+        statistics.seconds = chrono::duration<double>(chrono::steady_clock::now() - renderStart).count();
+#if defined(RT_STATISTICS)
+        PrintCounters(tiles);
+        if (writeCostMap && writeOutput && !outputPath.empty()) WriteCostMap();
+#endif
+        Finish(pool);
+    }
+
+    const Framebuffer& Image() const { return framebuffer; }
+    const FeatureImages& Features() const { return features; }
+    const RenderStatistics& Statistics() const { return statistics; }
+    const TraceCounters& Counters() const { return counters; } // Empty without RT_STATISTICS
+    int ImageHeight() const { return imageHeight; }
+
+    // Distributed rendering (see Distributed.h). The coordinator splits the image into jobs with
+    // BeginJobs, workers render them into tile-sized buffers with RenderJob, and the coordinator
+    // adds those in with MergeJob and finishes the image with FinishJobs. A job is a whole tile
+    // with every sample it still needs, so a merged tile holds exactly what Render would have
+    // accumulated there. That needs every pixel of a job to have the same samples left, so
+    // adaptive sampling and time budgets aren't supported, and a checkpoint only resumes if it
+    // is even over each job, as one the coordinator wrote with the same job size is.
+    struct TileJob {
+        int x0, y0, x1, y1;
+        uint32_t firstSample;
+        uint32_t sampleCount;
+    };
+
+    // Coordinator: sets up the image, resuming from checkpointPath if there is one, and fills
+    // 'jobs' with a job for every tile of jobSize pixels square that still needs samples.
+    // Returns false with 'error' if the settings or the checkpoint can't be split into jobs.
+    bool BeginJobs(int jobSize, vector<TileJob>& jobs, string& error) {
+        if (adaptiveSampling || timeBudget > 0) {
+            error = "Adaptive sampling and time budgets can't be split into jobs";
+            return false;
+        }
+        Initialize();
+        accumulation.Reset(imageWidth, imageHeight, writeFeatures || denoise);
+        ResumeCheckpoint();
+
+        jobs.clear();
+        for (int y = 0; y < imageHeight; y += jobSize) {
+            for (int x = 0; x < imageWidth; x += jobSize) {
+                TileJob job = { x, y, min(x + jobSize, imageWidth), min(y + jobSize, imageHeight), accumulation.SampleCount(x, y), 0 };
+                for (int pixelY = job.y0; pixelY < job.y1; pixelY++) {
+                    for (int pixelX = job.x0; pixelX < job.x1; pixelX++) {
+                        if (accumulation.SampleCount(pixelX, pixelY) == job.firstSample) continue;
+                        error = checkpointPath + " has tiles with uneven sample counts, from adaptive or timed sampling or "
+                            "another job size; resume it with a local render or delete it";
+                        return false;
+                    }
                 }
-                WriteColor(cout, pixelSampleScale * pixelColor);
+                if (job.firstSample >= uint32_t(samplesPerPixel)) continue;
+                job.sampleCount = uint32_t(samplesPerPixel) - job.firstSample;
+                jobs.push_back(job);
             }
         }
-        clog << "\nDone.		\n";
+        statistics = RenderStatistics();
+        lastCheckpoint = chrono::steady_clock::now();
+        return true;
+    }
+
+    // Coordinator: adds a finished job's samples and ray counts, checkpointing as Render does
+    void MergeJob(const TileJob& job, const AccumulationBuffer& tile, const RenderStatistics& jobStatistics) {
+        accumulation.Merge(tile, job.x0, job.y0);
+        statistics.primaryRays += jobStatistics.primaryRays;
+        statistics.secondaryRays += jobStatistics.secondaryRays;
+        statistics.shadowRays += jobStatistics.shadowRays;
+
+        auto now = chrono::steady_clock::now();
+        if (!checkpointPath.empty() && chrono::duration<double>(now - lastCheckpoint).count() >= checkpointInterval) {
+            if (!accumulation.SaveCheckpoint(checkpointPath, checkpointSettings))
+                cerr << "\nCould not write checkpoint " << checkpointPath << "\n";
+            lastCheckpoint = now;
+        }
+    }
+
+    // Coordinator: resolves, denoises and writes the image once every job is merged
+    void FinishJobs(double seconds) {
+        statistics.seconds = seconds;
+        ThreadPool pool(threadCount);
+        Finish(pool);
+    }
+
+    // Worker: sets up the camera and the scene's lights and sampler for RenderJob
+    void PrepareJobs(const Hittable& world) {
+        Initialize();
+        Prepare(world);
+    }
+
+    // Worker: renders a job into 'tile', which must be Reset to the job's size, with features if
+    // the coordinator wants them. The job is split into tileSize tiles across 'pool'.
+    RenderStatistics RenderJob(const TileJob& job, const Hittable& world, AccumulationBuffer& tile, ThreadPool& pool) {
+        RenderStatistics jobStatistics;
+        mutex statisticsMutex;
+        TaskGroup group;
+        for (int y = job.y0; y < job.y1; y += tileSize) {
+            for (int x = job.x0; x < job.x1; x += tileSize) {
+                Tile part = { x, y, min(x + tileSize, job.x1), min(y + tileSize, job.y1) };
+                pool.Submit(group, [&, part] {
+                    RenderStatistics partStatistics;
+                    auto samples = [&](uint32_t) { return pair(job.firstSample, job.sampleCount); };
+                    TraceTile(part, world, samples, [&](const PathState& path) { AddPath(path, partStatistics, tile, job.x0, job.y0); });
+
+                    lock_guard<mutex> lock(statisticsMutex);
+                    jobStatistics.primaryRays += partStatistics.primaryRays;
+                    jobStatistics.secondaryRays += partStatistics.secondaryRays;
+                    jobStatistics.shadowRays += partStatistics.shadowRays;
+                });
+            }
+        }
+        pool.Wait(group);
+        return jobStatistics;
     }
 
 private:
     /* Private Camera Variables Here */
     int imageHeight;
-    double pixelSampleScale;
     Point3 center;
     Point3 pixel00Location;
     Vector3 pixelDeltaU;
@@ -53,11 +374,108 @@ private:
     Vector3 u, v, w;
     Vector3 defocusDiskU;
     Vector3 defocusDiskV;
+    AccumulationBuffer accumulation;
+    unique_ptr<Sampler> sampler;
+    LightList lights;
+    Framebuffer framebuffer;
+    FeatureImages features;
+    RenderStatistics statistics;
+    AABB sceneBounds;
+    double sceneCellScale[3]; // Stream-mode Morton cells per unit along each axis
+    double pixelSpread;       // Angle a ray's cone widens by per unit travelled
+    chrono::steady_clock::time_point lastCheckpoint;
+    CheckpointSettings checkpointSettings;
+    TraceCounters counters;
+    vector<uint64_t> pixelWork;  // Traversal work of this Render's paths, per pixel
+    vector<uint32_t> pixelPaths;
+    vector<uint64_t> passWork;   // The same for the pass in flight, added in once it's merged
+    vector<uint32_t> passPaths;
+    vector<double> tileSeconds;
+
+    // Sample dimensions: the pixel offset and lens position, then a block for each bounce holding
+    // the scatter's draws, the Russian roulette decision and the light sample
+    static constexpr uint32_t cameraDimensions = 4;
+    static constexpr uint32_t scatterDimensions = 3;
+    static constexpr uint32_t rouletteDimension = scatterDimensions;
+    static constexpr uint32_t lightDimension = rouletteDimension + 1;
+    static constexpr uint32_t bounceDimensions = lightDimension + 3;
+
+    struct Tile {
+        int x0, y0, x1, y1;
+    };
+
+    struct PathState {
+        Ray ray;
+        Color throughput;
+        Color radiance;    // Gathered so far
+        double scatterPdf; // Density the ray's direction was chosen with; 0 if lights weren't sampled there
+        uint32_t pixel;
+        uint32_t sample;
+        uint32_t rays;       // Camera ray and bounces traced
+        uint32_t shadowRays;
+        double coneWidth;    // Width of the ray's cone at its origin, for texture filtering
+
+        // Denoising guides, rewritten at each vertex until the path leaves a non-specular one
+        bool featuresPending;
+        Color featureTint;  // Product of the specular albedos passed through
+        Color albedo;
+        Vector3 normal;
+        double depth;       // Distance travelled to the vertex
+
+#if defined(RT_STATISTICS)
+        uint64_t work;      // TraceCounters::Work() spent on this path's rays
+#endif
+    };
+
+    void ResumeCheckpoint() {
+        if (checkpointPath.empty()) return;
+        string error;
+        if (accumulation.LoadCheckpoint(checkpointPath, imageWidth, imageHeight, checkpointSettings, error))
+            clog << "Resuming from " << checkpointPath << " with " << accumulation.TotalSamples() << " samples taken\n";
+        else if (!error.empty())
+            clog << "Not resuming from " << checkpointPath << ", it was " << error << "\n";
+    }
+
+    void Prepare(const Hittable& world) {
+        sampler = Sampler::Create(samplerType, seed, uint32_t(samplesPerPixel), imageWidth);
+        lights = LightList(world);
+        sceneBounds = world.BoundingBox();
+        for (int axis = 0; axis < 3; axis++) {
+            double size = sceneBounds.AxisInterval(axis).Size();
+            sceneCellScale[axis] = size > 0 && size < infinity ? 32 / size : 0;
+        }
+    }
+
+    void Finish(ThreadPool& pool) {
+        accumulation.Resolve(framebuffer);
+        if (accumulation.HasFeatures()) {
+            accumulation.ResolveFeatures(features);
+            if (writeOutput && writeFeatures && !outputPath.empty() && !WriteFeatures()) return;
+            if (denoise) {
+                auto start = chrono::steady_clock::now();
+                denoiser.Denoise(framebuffer, features, pool);
+                clog << "\nDenoised in " << chrono::duration<double, milli>(chrono::steady_clock::now() - start).count() << " ms";
+            }
+        }
+
+        if (writeOutput && outputPath.empty()) {
+            WriteImage(framebuffer, cout, ImageFormat::PPMText);
+        }
+        else if (writeOutput && !WriteImage(framebuffer, outputPath)) {
+            cerr << "\nCould not write " << outputPath << "\n";
+            return;
+        }
+
+        if (!checkpointPath.empty()) {
+            error_code ignored;
+            filesystem::remove(checkpointPath, ignored);
+        }
+        clog << "\nDone.		\n";
+    }
 
     void Initialize() {
         imageHeight = int(imageWidth / aspectRatio);
         imageHeight = imageHeight < 1 ? 1 : imageHeight;
-        pixelSampleScale = 1.0 / samplesPerPixel;
         center = lookFrom;
 
         // Determine viewport dimensions
@@ -86,47 +504,498 @@ private:
         double defocusRadius = focusDistance * tan(DegreesToRadians(defocusAngle / 2));
         defocusDiskU = u * defocusRadius;
         defocusDiskV = v * defocusRadius;
+
+        // Ray cones (Akenine-Moller et al., Ray Tracing Gems ch. 20) start at a pixel's angle,
+        // narrowed as pbrt-v4 does when many samples already average over the pixel. Bounces
+        // don't widen the cone, which keeps textures seen in mirrors and glass sharp and only
+        // under-filters what diffuse bounces see, where the noise dominates anyway.
+        pixelSpread = pixelDeltaV.Length() / focusDistance * fmax(0.125, 1 / sqrt(fmax(1, samplesPerPixel)));
+
+        uint64_t scene = sceneFingerprint;
+        for (double value : { lookFrom.x(), lookFrom.y(), lookFrom.z(), lookAt.x(), lookAt.y(), lookAt.z(), up.x(), up.y(), up.z(),
+            aspectRatio, verticalFov, defocusAngle, focusDistance })
+            scene = Rng::Mix(scene ^ bit_cast<uint64_t>(value));
+        checkpointSettings = { seed, scene, samplesPerPixel, int32_t(samplerType), maxDepth, rouletteDepth, skyLight };
+    }
+
+#if defined(RT_STATISTICS)
+    void PrintCounters(const vector<Tile>& tiles) const {
+        uint64_t rays = max<uint64_t>(1, statistics.TotalRays());
+        clog << "\nRays: " << statistics.primaryRays << " primary, " << statistics.secondaryRays << " secondary, "
+            << statistics.shadowRays << " shadow\n";
+        clog << "Per ray: " << double(counters.hitCalls) / rays << " Hit calls, " << double(counters.nodesVisited) / rays
+            << " BVH nodes, " << double(counters.primitiveTests) / rays << " primitive tests\n";
+
+        clog << "Scatter calls:";
+        for (int kind = 0; kind < int(ScatterKind::Count); kind++) {
+            if (counters.scatterCalls[kind]) clog << " " << ScatterKindName(ScatterKind(kind)) << " " << counters.scatterCalls[kind];
+        }
+
+        // Lengths up to where 99.9% of paths have ended, then the tail as one figure
+        uint64_t paths = 0, shown = 0;
+        for (uint64_t count : counters.pathLengths) paths += count;
+        clog << "\nPath lengths (rays: % of paths):";
+        for (uint32_t length = 0; length <= TraceCounters::maxPathLength && shown < paths * 0.999; length++) {
+            if (counters.pathLengths[length] == 0) continue;
+            clog << " " << length << ": " << 100.0 * counters.pathLengths[length] / paths;
+            shown += counters.pathLengths[length];
+        }
+        if (shown < paths) clog << " longer: " << 100.0 * (paths - shown) / paths;
+
+        // The slowest tiles point at the expensive parts of the image
+        vector<size_t> order(tiles.size());
+        for (size_t tile = 0; tile < order.size(); tile++) order[tile] = tile;
+        sort(order.begin(), order.end(), [&](size_t a, size_t b) { return tileSeconds[a] > tileSeconds[b]; });
+        clog << "\nTile ms: fastest " << tileSeconds[order.back()] * 1000 << ", median " << tileSeconds[order[order.size() / 2]] * 1000
+            << ", slowest";
+        for (size_t rank = 0; rank < min<size_t>(5, order.size()); rank++) {
+            const Tile& tile = tiles[order[rank]];
+            clog << " " << tileSeconds[order[rank]] * 1000 << " at (" << tile.x0 << ", " << tile.y0 << ")";
+        }
+        clog << "\n";
+    }
+
+    void WriteCostMap() const {
+        vector<float> cost(pixelWork.size());
+        for (size_t pixel = 0; pixel < cost.size(); pixel++)
+            cost[pixel] = pixelPaths[pixel] ? float(pixelWork[pixel]) / pixelPaths[pixel] : 0.0f;
+
+        vector<float> sorted = cost;
+        size_t percentile = sorted.size() * 99 / 100;
+        nth_element(sorted.begin(), sorted.begin() + percentile, sorted.end());
+        float scale = sorted[percentile] > 0 ? 1 / sorted[percentile] : 0;
+
+        // Black, red, yellow, white, each stop a third of the way up
+        Framebuffer map(imageWidth, imageHeight);
+        for (size_t pixel = 0; pixel < cost.size(); pixel++) {
+            double t = fmin(cost[pixel] * scale, 1.0) * 3;
+            map.Set(int(pixel % imageWidth), int(pixel / imageWidth), Color(fmin(t, 1.0), Interval(0, 1).Clamp(t - 1), Interval(0, 1).Clamp(t - 2)));
+        }
+
+        string path = SidecarPath("cost");
+        if (!WriteImage(map, path)) cerr << "\nCould not write " << path << "\n";
+        else clog << "Cost map: white is " << sorted[percentile] << " BVH nodes and primitive tests per sample\n";
+    }
+#endif
+
+    // <name>.<suffix><ext> next to the output image
+    string SidecarPath(const char* suffix) const {
+        filesystem::path path(outputPath);
+        return (path.parent_path() / (path.stem().string() + "." + suffix + path.extension().string())).string();
+    }
+
+    bool WriteFeatures() const {
+        const pair<const char*, const Framebuffer*> images[] = { { "albedo", &features.albedo }, { "normal", &features.normal }, { "depth", &features.depth } };
+        for (const auto& [name, image] : images) {
+            string featurePath = SidecarPath(name);
+            if (!WriteImage(*image, featurePath)) {
+                cerr << "\nCould not write " << featurePath << "\n";
+                return false;
+            }
+        }
+        return true;
+    }
+
+    // Decides how many samples every pixel takes in the next pass, based only on what has been
+    // accumulated so far (so a resumed render makes the same decisions) and, in timed renders,
+    // on 'limit', the most samples there is time for. Returns the total.
+    uint64_t PlanPass(vector<uint16_t>& plan, uint64_t limit) const {
+        size_t pixelCount = accumulation.PixelCount();
+        int passSize = int(min<uint64_t>(max(1, samplesPerPass), limit / pixelCount));
+        uint64_t planned = 0;
+
+        auto planUpTo = [&](int target) {
+            for (size_t pixel = 0; pixel < pixelCount; pixel++) {
+                int missing = max(0, target - int(accumulation.SampleCount(pixel)));
+                plan[pixel] = uint16_t(min(passSize, missing));
+                planned += plan[pixel];
+            }
+            return planned;
+        };
+
+        if (!adaptiveSampling) return planUpTo(samplesPerPixel);
+
+        // Sample everything uniformly until each pixel has enough samples to estimate its variance
+        int warmup = clamp(minSamples, 2, max(2, samplesPerPixel));
+        for (size_t pixel = 0; pixel < pixelCount; pixel++) {
+            if (accumulation.SampleCount(pixel) < uint32_t(warmup)) return planUpTo(warmup);
+        }
+
+        uint64_t budget = uint64_t(samplesPerPixel) * pixelCount;
+        uint64_t spent = accumulation.TotalSamples();
+        if (spent >= budget) return 0;
+
+        uint64_t activeCount = 0;
+        for (size_t pixel = 0; pixel < pixelCount; pixel++) {
+            bool active = accumulation.SampleCount(pixel) < uint32_t(maxSamples) && accumulation.RelativeError(pixel) > errorTarget;
+            plan[pixel] = active ? 1 : 0;
+            activeCount += plan[pixel];
+        }
+        if (activeCount == 0) return 0;
+
+        // Share the remaining budget evenly, up to one pass, among the pixels still above target
+        uint64_t share = min<uint64_t>({ uint64_t(max(1, samplesPerPass)), (budget - spent) / activeCount, limit / activeCount });
+        if (share == 0) return 0;
+        for (size_t pixel = 0; pixel < pixelCount; pixel++) {
+            if (!plan[pixel]) continue;
+            plan[pixel] = uint16_t(min<uint64_t>(share, uint64_t(maxSamples) - accumulation.SampleCount(pixel)));
+            planned += plan[pixel];
+        }
+        return planned;
+    }
+
+    bool TileHasWork(const Tile& tile, const vector<uint16_t>& plan) const {
+        for (int j = tile.y0; j < tile.y1; j++) {
+            for (int i = tile.x0; i < tile.x1; i++) {
+                if (plan[size_t(j) * imageWidth + i]) return true;
+            }
+        }
+        return false;
+    }
+
+    // Traces samples [first, first + count) of every pixel in the tile, where samples(pixel)
+    // returns that pair, and passes each finished path to add() in pixel then sample order
+    template <typename Samples, typename Add>
+    void TraceTile(const Tile& tile, const Hittable& world, const Samples& samples, const Add& add) const {
+        if (!streamMode) {
+            for (int j = tile.y0; j < tile.y1; j++) {
+                for (int i = tile.x0; i < tile.x1; i++) {
+                    auto [firstSample, sampleCount] = samples(uint32_t(j * imageWidth + i));
+                    for (uint32_t sample = firstSample; sample < firstSample + sampleCount; sample++) {
+                        PathState path = StartPath(i, j, sample);
+                        TracePath(path, world);
+                        add(path);
+                    }
+                }
+            }
+            return;
+        }
+
+        // Stream mode creates the paths in the same order and adds their results back in that
+        // order, so the accumulated sums come out bit for bit the same
+        vector<PathState> paths;
+        for (int j = tile.y0; j < tile.y1; j++) {
+            for (int i = tile.x0; i < tile.x1; i++) {
+                auto [firstSample, sampleCount] = samples(uint32_t(j * imageWidth + i));
+                for (uint32_t sample = firstSample; sample < firstSample + sampleCount; sample++)
+                    paths.push_back(StartPath(i, j, sample));
+            }
+        }
+
+        vector<uint32_t> active(paths.size()), next;
+        for (uint32_t path = 0; path < active.size(); path++) active[path] = path;
+        StreamBuffers buffers;
+        buffers.records.resize(paths.size());
+        buffers.hits.resize(paths.size());
+
+        for (int bounce = 1; bounce <= maxDepth && !active.empty(); bounce++) {
+            SortStream(paths, active, buffers);
+
+            // Trace the whole bounce first so traversal runs without shading code in between
+            vector<HitRecord>& records = buffers.records;
+            vector<char>& hits = buffers.hits;
+            for (size_t k = 0; k < active.size(); k++) {
+                PathState& path = paths[active[k]];
+                hits[k] = TraceRay(path, path.ray, Interval(0.001, infinity), records[k], world);
+            }
+
+            next.clear();
+            for (size_t k = 0; k < active.size(); k++) {
+                if (ContinuePath(paths[active[k]], bounce, hits[k], records[k], world))
+                    next.push_back(active[k]);
+            }
+            swap(active, next);
+        }
+        // Paths still active at maxDepth gather nothing more, as in TracePath
+
+        for (const PathState& path : paths) add(path);
+    }
+
+    PathState StartPath(int i, int j, uint32_t sample) const {
+        uint32_t pixel = uint32_t(j * imageWidth + i);
+        PathSampler cameraSampler(*sampler, pixel, sample, 0, cameraDimensions, Rng::ForPath(pixel, sample, 0, seed));
+        PathState path;
+        path.ray = GetRay(i, j, cameraSampler);
+        path.throughput = Color(1, 1, 1);
+        path.radiance = Color(0, 0, 0);
+        path.scatterPdf = 0;
+        path.pixel = pixel;
+        path.sample = sample;
+        path.rays = 0;
+        path.shadowRays = 0;
+        path.coneWidth = 0;
+        path.featuresPending = writeFeatures || denoise;
+        path.featureTint = Color(1, 1, 1);
+        path.depth = 0;
+#if defined(RT_STATISTICS)
+        path.work = 0;
+#endif
+        return path;
+    }
+
+    // Adds a path's result to 'target', whose top left pixel is (originX, originY) of the image
+    void AddPath(const PathState& path, RenderStatistics& tileStatistics, AccumulationBuffer& target, int originX, int originY) {
+        tileStatistics.primaryRays += path.rays > 0;
+        tileStatistics.secondaryRays += path.rays > 0 ? path.rays - 1 : 0;
+        tileStatistics.shadowRays += path.shadowRays;
+
+        TRACE_COUNT(pathLengths[min(path.rays, TraceCounters::maxPathLength)]);
+#if defined(RT_STATISTICS)
+        if (!passWork.empty()) {
+            passWork[path.pixel] += path.work;
+            passPaths[path.pixel]++;
+        }
+#endif
+
+        int x = int(path.pixel % imageWidth) - originX, y = int(path.pixel / imageWidth) - originY;
+        target.AddSample(x, y, path.radiance);
+        if (target.HasFeatures()) target.AddFeatures(x, y, path.albedo, path.normal, path.depth);
     }
 
-    Ray GetRay(int i, int j) const {
+    struct StreamBuffers {
+        vector<uint32_t> keys, sortedKeys, sortedPaths;
+        vector<HitRecord> records;
+        vector<char> hits;
+    };
+
+    // Bins the active paths by an 18-bit key: direction octant, then a 15-bit Morton code of
+    // the origin's cell in a 32^3 grid over the scene bounds. Two stable 9-bit radix passes
+    // keep it linear in the stream length.
+    void SortStream(const vector<PathState>& paths, vector<uint32_t>& active, StreamBuffers& buffers) const {
+        static constexpr int radixBits = 9;
+        static constexpr uint32_t radixSize = 1u << radixBits;
+
+        size_t count = active.size();
+        vector<uint32_t>& keys = buffers.keys;
+        keys.resize(count);
+        buffers.sortedKeys.resize(count);
+        buffers.sortedPaths.resize(count);
+
+        for (size_t k = 0; k < count; k++) {
+            const Ray& ray = paths[active[k]].ray;
+            const Vector3& direction = ray.Direction();
+            uint32_t octant = (direction.x() < 0 ? 1 : 0) | (direction.y() < 0 ? 2 : 0) | (direction.z() < 0 ? 4 : 0);
+
+            uint32_t morton = 0;
+            for (int axis = 0; axis < 3; axis++) {
+                double relative = (ray.Origin()[axis] - sceneBounds.AxisInterval(axis).min) * sceneCellScale[axis];
+                morton |= SpreadBits(uint32_t(Interval(0, 31).Clamp(relative))) << axis;
+            }
+            keys[k] = octant << 15 | morton;
+        }
+
+        for (int shift = 0; shift < 2 * radixBits; shift += radixBits) {
+            uint32_t offsets[radixSize] = {};
+            for (size_t k = 0; k < count; k++) offsets[(keys[k] >> shift) & (radixSize - 1)]++;
+
+            uint32_t total = 0;
+            for (uint32_t& offset : offsets) {
+                uint32_t binSize = offset;
+                offset = total;
+                total += binSize;
+            }
+
+            for (size_t k = 0; k < count; k++) {
+                uint32_t slot = offsets[(keys[k] >> shift) & (radixSize - 1)]++;
+                buffers.sortedKeys[slot] = keys[k];
+                buffers.sortedPaths[slot] = active[k];
+            }
+            swap(keys, buffers.sortedKeys);
+            swap(active, buffers.sortedPaths);
+        }
+    }
+
+    // Spaces the low 10 bits of 'value' three apart, for interleaving into a Morton code
+    static uint32_t SpreadBits(uint32_t value) {
+        value = (value | (value << 16)) & 0x030000ff;
+        value = (value | (value << 8)) & 0x0300f00f;
+        value = (value | (value << 4)) & 0x030c30c3;
+        value = (value | (value << 2)) & 0x09249249;
+        return value;
+    }
+
+    Ray GetRay(int i, int j, PathSampler& cameraSampler) const {
         // Construct a camera ray originating from the defocus disk and directed at randomly sampled
         // point around the pixel location i, j.
 
-        Vector3 offset = SampleSquare();
+        Vector3 offset = SampleSquare(cameraSampler);
         Point3 pixelSample = pixel00Location
             + ((i + offset.x()) * pixelDeltaU)
             + ((j + offset.y()) * pixelDeltaV);
 
-        Point3 rayOrigin = defocusAngle <= 0 ? center : DefocusDiskSample();
+        Point3 rayOrigin = defocusAngle <= 0 ? center : DefocusDiskSample(cameraSampler);
         Vector3 rayDirection = pixelSample - rayOrigin;
 
         return Ray(rayOrigin, rayDirection);
     }
 
-    Vector3 SampleSquare() const {
-        // Returns the vector to a random point in the [-.5,-.5]-[+.5,+.5] unit square.
-        return Vector3(RandomDouble() - 0.5, RandomDouble() - 0.5, 0);
+    Vector3 SampleSquare(PathSampler& cameraSampler) const {
+        // Returns the vector to a sampled point in the [-.5,-.5]-[+.5,+.5] unit square.
+        double x, y;
+        cameraSampler.Next2D(x, y);
+        return Vector3(x - 0.5, y - 0.5, 0);
     }
 
-    Point3 DefocusDiskSample() const{
-        Point3 point = RandomInUnitDisk();
+    Point3 DefocusDiskSample(PathSampler& cameraSampler) const{
+        Point3 point = RandomInUnitDisk(cameraSampler);
         return center + point[0] * defocusDiskU + point[1] * defocusDiskV;
     }
 
-    Color RayColor(const Ray& ray, int depth, const Hittable& world) const {
+    // The kind of a material as CallMaterial passes it: its own type in closed-world dispatch, a
+    // Material in virtual dispatch
+    template <typename MaterialType>
+    static ScatterKind ScatterKindOf(const MaterialType& material) {
+        if constexpr (is_same_v<MaterialType, Lambertian>) return ScatterKind::Lambertian;
+        else if constexpr (is_same_v<MaterialType, Metal>) return ScatterKind::Metal;
+        else if constexpr (is_same_v<MaterialType, Dielectric>) return ScatterKind::Dielectric;
+        else if constexpr (is_same_v<MaterialType, DiffuseLight>) return ScatterKind::Light;
+        else if (dynamic_cast<const Lambertian*>(&material)) return ScatterKind::Lambertian;
+        else if (dynamic_cast<const Metal*>(&material)) return ScatterKind::Metal;
+        else if (dynamic_cast<const Dielectric*>(&material)) return ScatterKind::Dielectric;
+        else if (dynamic_cast<const DiffuseLight*>(&material)) return ScatterKind::Light;
+        else return ScatterKind::Other;
+    }
+
+    // Calls 'function' on a material through the closed-world table or the Material interface,
+    // whichever materialDispatch asks for
+    template <typename Function>
+    decltype(auto) CallMaterial(uint32_t id, Function&& function) const {
+        const MaterialTable& materials = MaterialTable::Global();
+        if (materialDispatch == Dispatch::ClosedWorld) return materials.Visit(id, function);
+        return function(materials[id]);
+    }
+
+    // world.Hit for one of the path's rays, charging the traversal work to the path
+    bool TraceRay(PathState& path, const Ray& ray, Interval rayT, HitRecord& record, const Hittable& world) const {
+#if defined(RT_STATISTICS)
+        uint64_t workBefore = TraceCounters::Local().Work();
+        bool hit = world.Hit(ray, rayT, record);
+        path.work += TraceCounters::Local().Work() - workBefore;
+        return hit;
+#else
+        (void)path;
+        return world.Hit(ray, rayT, record);
+#endif
+    }
+
+    void TracePath(PathState& path, const Hittable& world) const {
         //Stop getting light if we exceed the bounce limit
-        if (depth <= 0) return Color(0, 0, 0);
+        for (int bounce = 1; bounce <= maxDepth; bounce++) {
+            HitRecord record;
+            bool hit = TraceRay(path, path.ray, Interval(0.001, infinity), record, world);
+            if (!ContinuePath(path, bounce, hit, record, world)) break;
+        }
+    }
+
+    // Shades one bounce of a path given what its ray hit, adding what it gathers to the path's
+    // radiance. Returns true with the ray and throughput updated if the path goes on.
+    bool ContinuePath(PathState& path, int bounce, bool hit, HitRecord& record, const Hittable& world) const {
+        path.rays++;
+        if (!hit) {
+            Color sky = skyLight ? SkyColor(path.ray) : Color(0, 0, 0);
+            path.radiance += path.throughput * sky;
+            if (path.featuresPending) {
+                // The sky's normal faces back along the ray so neighbouring sky pixels filter together
+                path.albedo = path.featureTint * sky;
+                path.normal = -UnitVector(path.ray.Direction());
+                path.featuresPending = false;
+            }
+            return false;
+        }
+        record.object->ComputeSurface(path.ray, record);
+        path.coneWidth += pixelSpread * record.t * path.ray.Direction().Length();
+        if (MaterialTable::Global().UsesTexture(record.materialId)) {
+            record.object->ComputeTextureCoordinates(path.ray, record);
+            // The cone meets a tilted surface in a longer ellipse; its major axis is the width used
+            double cosine = fabs(Dot(UnitVector(path.ray.Direction()), record.normal));
+            record.footprint = path.coneWidth / fmax(cosine, 0.1);
+        }
 
-        HitRecord record;
+        // Emission reached by following the BSDF, weighted against having sampled it as a light
+        Color emitted = CallMaterial(record.materialId, [&](const auto& material) { return material.Emitted(record); });
+        if (emitted.LengthSquared() > 0) {
+            double weight = path.scatterPdf > 0 ? PowerHeuristic(path.scatterPdf, lights.Pdf(path.ray, record)) : 1;
+            path.radiance += weight * path.throughput * emitted;
+        }
+        if (path.featuresPending) RecordFeatures(path, record, emitted);
+
+        // Each bounce draws from its own block of dimensions (and its own fallback stream) so paths
+        // stay independent of evaluation order
+        uint32_t firstDimension = cameraDimensions + uint32_t(bounce - 1) * bounceDimensions;
+        if (!lights.Empty()) SampleLight(path, record, firstDimension + lightDimension, world);
+
+        PathSampler scatterSampler(*sampler, path.pixel, path.sample, firstDimension, scatterDimensions, Rng::ForPath(path.pixel, path.sample, uint32_t(bounce), seed));
+        Ray scattered;
+        Color attenuation;
+        bool scatters = CallMaterial(record.materialId, [&](const auto& material) {
+            TRACE_COUNT(scatterCalls[int(ScatterKindOf(material))]);
+            return material.Scatter(path.ray, record, attenuation, scattered, scatterSampler);
+        });
+        if (!scatters) return false;
+        path.throughput = path.throughput * attenuation;
+
+        path.scatterPdf = 0;
+        if (!lights.Empty()) {
+            Color value;
+            double pdf;
+            if (CallMaterial(record.materialId, [&](const auto& material) { return material.Evaluate(record, scattered.Direction(), value, pdf); }))
+                path.scatterPdf = pdf;
+        }
 
-        if (world.Hit(ray, Interval(0.001, infinity), record)) {
-            Ray scattered;
-            Color attenuation;
-            if (record.material->Scatter(ray, record, attenuation, scattered))
-                return attenuation * RayColor(scattered, depth - 1, world);
-            return Color(0, 0, 0);
+        // Russian roulette: end dim paths at random and boost the survivors to keep the estimate unbiased
+        if (bounce >= rouletteDepth) {
+            double survival = fmin(fmax(path.throughput.x(), fmax(path.throughput.y(), path.throughput.z())), 0.95);
+            if (sampler->Get1D(path.pixel, path.sample, firstDimension + rouletteDimension) >= survival) return false;
+            path.throughput = path.throughput / survival;
         }
+        path.ray = scattered;
+        return true;
+    }
+
+    // Mirrors and glass, which can't be evaluated, are looked through: their albedo tints
+    // whatever is found behind them. A light's albedo is its emission, so it demodulates to one.
+    void RecordFeatures(PathState& path, const HitRecord& record, const Color& emitted) const {
+        bool emissive = emitted.LengthSquared() > 0;
+        Color albedo = emissive ? emitted : CallMaterial(record.materialId, [&](const auto& material) { return material.Albedo(record); });
+        path.albedo = path.featureTint * albedo;
+        path.normal = record.normal;
+        path.depth += record.t * path.ray.Direction().Length();
+
+        Color value;
+        double pdf;
+        bool specular = !emissive && !CallMaterial(record.materialId, [&](const auto& material) { return material.Evaluate(record, record.normal, value, pdf); });
+        if (specular) path.featureTint = path.albedo;
+        else path.featuresPending = false;
+    }
+
+    // Next-event estimation: picks a point on a light, traces a shadow ray to it and adds its
+    // contribution, weighted by the power heuristic against finding it through the BSDF.
+    // Surfaces whose scattering can't be evaluated (mirrors, glass) are skipped.
+    void SampleLight(PathState& path, const HitRecord& record, uint32_t dimension, const Hittable& world) const {
+        double u, v;
+        sampler->Get2D(path.pixel, path.sample, dimension + 1, u, v);
+        LightSample light;
+        if (!lights.Sample(record.point, sampler->Get1D(path.pixel, path.sample, dimension), u, v, light)) return;
+
+        Color value;
+        double scatterPdf;
+        if (!CallMaterial(record.materialId, [&](const auto& material) { return material.Evaluate(record, light.direction, value, scatterPdf); }))
+            return;
+        if (value.LengthSquared() == 0) return;
+
+        HitRecord occluder;
+        path.shadowRays++;
+        if (TraceRay(path, Ray(record.point, light.direction), Interval(0.001, light.distance - 0.001), occluder, world)) return;
+
+        double weight = PowerHeuristic(light.pdf, scatterPdf);
+        path.radiance += (weight / light.pdf) * path.throughput * value * light.radiance;
+    }
+
+    static double PowerHeuristic(double pdf, double otherPdf) {
+        return pdf * pdf / (pdf * pdf + otherPdf * otherPdf);
+    }
 
+    static Color SkyColor(const Ray& ray) {
         Vector3 unitDirection = UnitVector(ray.Direction());
         double a = 0.5 * (unitDirection.y() + 1);
         Color skyGradientTop = Color(1, 0.7, 0.5);
@@ -4,6 +4,13 @@
 #include "Interval.h"
 #include "Vector3.h"
 
+#include <cstddef>
+#include <cstdint>
+
+#if defined(__AVX2__)
+#include <immintrin.h>
+#endif
+
 using Color = Vector3;
 
 inline double LinearToGamma(double linearComponent) {
@@ -32,4 +39,28 @@ void WriteColor(std::ostream& out, const Color& pixelColor) {
     out << rbyte << ' ' << gbyte << ' ' << bbyte << '\n';
 }
 
+// Gamma-corrects and quantizes a whole buffer of linear components to bytes in one pass,
+// matching WriteColor component for component.
+inline void QuantizeToBytes(const float* linear, size_t count, uint8_t* bytes) {
+    size_t i = 0;
+#if defined(__AVX2__)
+    const __m256 zero = _mm256_setzero_ps();
+    const __m256 maximum = _mm256_set1_ps(0.999f);
+    const __m256 scale = _mm256_set1_ps(256.0f);
+    for (; i + 8 <= count; i += 8) {
+        __m256 value = _mm256_sqrt_ps(_mm256_max_ps(_mm256_loadu_ps(linear + i), zero));
+        __m256i integers = _mm256_cvttps_epi32(_mm256_mul_ps(_mm256_min_ps(value, maximum), scale));
+
+        // Narrow the eight 32-bit lanes down to eight bytes
+        __m128i words = _mm_packus_epi32(_mm256_castsi256_si128(integers), _mm256_extracti128_si256(integers, 1));
+        _mm_storel_epi64(reinterpret_cast<__m128i*>(bytes + i), _mm_packus_epi16(words, words));
+    }
+#endif
+    for (; i < count; i++) {
+        float value = linear[i] > 0 ? std::sqrt(linear[i]) : 0.0f;
+        value = value < 0.999f ? value : 0.999f;
+        bytes[i] = uint8_t(256 * value);
+    }
+}
+
 #endif
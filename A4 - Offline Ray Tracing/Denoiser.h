@@ -0,0 +1,289 @@
+#ifndef DENOISER_H
+#define DENOISER_H
+
+#include "AccumulationBuffer.h"
+#include "Framebuffer.h"
+#include "ThreadPool.h"
+
+#include <algorithm>
+#include <cmath>
+#include <vector>
+
+#if defined(__AVX2__)
+#include <immintrin.h>
+#endif
+
+// Edge-avoiding a-trous wavelet filter (Dammertz et al. 2010) with the variance-guided
+// luminance weight of SVGF (Schied et al. 2017), for a single converged-but-noisy frame.
+//
+// The image is divided by its albedo first, so the filter smooths lighting rather than surface
+// color, and multiplied back at the end. Each iteration applies a 5x5 B3-spline kernel with its
+// taps spread 2^i pixels apart. A tap's weight falls off with the luminance difference measured
+// in standard deviations of the noise, with the depth difference relative to the local depth
+// slope, and with the angle between normals. Rows are filtered in bands on the thread pool,
+// eight pixels at a time with AVX2.
+class Denoiser {
+public:
+    int iterations = 5;     // Five reach 62 pixels out
+    float colorSigma = 2;   // How many standard deviations of noise a luminance step must exceed to stop the filter
+    float depthSigma = 1;
+
+    void Denoise(Framebuffer& image, const FeatureImages& features, ThreadPool& pool) {
+        width = image.Width();
+        height = image.Height();
+        size_t pixelCount = image.PixelCount();
+        if (pixelCount == 0 || iterations <= 0) return;
+
+        for (std::vector<float>& plane : guide) plane.resize(pixelCount);
+        for (Planes& planes : ping) {
+            for (std::vector<float>& plane : planes) plane.resize(pixelCount);
+        }
+        inverseSigma.resize(pixelCount);
+
+        // Demodulate, and bring the luminance variance along by the same factor squared
+        const float* color = image.Data();
+        const float* albedo = features.albedo.Data();
+        const float* normal = features.normal.Data();
+        Planes& input = ping[0];
+        for (size_t pixel = 0; pixel < pixelCount; pixel++) {
+            for (int channel = 0; channel < 3; channel++)
+                input[channel][pixel] = color[pixel * 3 + channel] / (albedo[pixel * 3 + channel] + albedoEpsilon);
+            float albedoLuminance = Luminance(albedo[pixel * 3] + albedoEpsilon, albedo[pixel * 3 + 1] + albedoEpsilon, albedo[pixel * 3 + 2] + albedoEpsilon);
+            input[3][pixel] = features.variance[pixel] / (albedoLuminance * albedoLuminance);
+
+            // Normals averaged over a pixel's samples come out short at silhouettes
+            float x = normal[pixel * 3], y = normal[pixel * 3 + 1], z = normal[pixel * 3 + 2];
+            float length = std::sqrt(x * x + y * y + z * z);
+            float scale = length > 0 ? 1 / length : 0;
+            guide[NormalX][pixel] = x * scale;
+            guide[NormalY][pixel] = y * scale;
+            guide[NormalZ][pixel] = z * scale;
+            guide[Depth][pixel] = features.depth.Data()[pixel * 3];
+        }
+        ComputeDepthSlopes();
+
+        int current = 0;
+        for (int iteration = 0; iteration < iterations; iteration++) {
+            ForEachBand(pool, [&](int y0, int y1) { ComputeInverseSigmas(ping[current], y0, y1); });
+            ForEachBand(pool, [&](int y0, int y1) { FilterRows(ping[current], ping[1 - current], 1 << iteration, y0, y1); });
+            current = 1 - current;
+        }
+
+        float* output = image.Data();
+        for (size_t pixel = 0; pixel < pixelCount; pixel++) {
+            for (int channel = 0; channel < 3; channel++)
+                output[pixel * 3 + channel] = ping[current][channel][pixel] * (albedo[pixel * 3 + channel] + albedoEpsilon);
+        }
+    }
+
+private:
+    enum GuidePlane { NormalX, NormalY, NormalZ, Depth, DepthSlope, GuideCount };
+    using Planes = std::vector<float>[4]; // Demodulated RGB, then luminance variance
+
+    static constexpr float albedoEpsilon = 0.001f;
+    static constexpr float kernel[5] = { 1.0f / 16, 1.0f / 4, 3.0f / 8, 1.0f / 4, 1.0f / 16 };
+    static constexpr int bandHeight = 8;
+
+    // Scratch reused between calls
+    int width = 0, height = 0;
+    std::vector<float> guide[GuideCount];
+    Planes ping[2];
+    std::vector<float> inverseSigma;
+
+    static float Luminance(float r, float g, float b) {
+        return 0.2126f * r + 0.7152f * g + 0.0722f * b;
+    }
+
+    template <typename Function>
+    void ForEachBand(ThreadPool& pool, Function&& function) const {
+        TaskGroup group;
+        for (int y = 0; y < height; y += bandHeight)
+            pool.Submit(group, [&function, y, this] { function(y, std::min(y + bandHeight, height)); });
+        pool.Wait(group);
+    }
+
+    // Depth change per pixel along the flatter side of each axis, so a silhouette doesn't make
+    // its own pixels look steep
+    void ComputeDepthSlopes() {
+        const std::vector<float>& depth = guide[Depth];
+        auto slope = [&](size_t pixel, int coordinate, int size, size_t stride) {
+            float best = INFINITY;
+            if (coordinate > 0) best = std::fabs(depth[pixel] - depth[pixel - stride]);
+            if (coordinate + 1 < size) best = std::fmin(best, std::fabs(depth[pixel + stride] - depth[pixel]));
+            return best == INFINITY ? 0.0f : best;
+        };
+        for (int y = 0; y < height; y++) {
+            for (int x = 0; x < width; x++) {
+                size_t pixel = size_t(y) * width + x;
+                guide[DepthSlope][pixel] = std::fmax(slope(pixel, x, width, 1), slope(pixel, y, height, size_t(width)));
+            }
+        }
+    }
+
+    // The luminance weight's scale: a 3x3 Gaussian of the variance, as a reciprocal deviation
+    void ComputeInverseSigmas(const Planes& input, int y0, int y1) {
+        const std::vector<float>& variance = input[3];
+        for (int y = y0; y < y1; y++) {
+            for (int x = 0; x < width; x++) {
+                float sum = 0, weights = 0;
+                for (int dy = -1; dy <= 1; dy++) {
+                    int qy = y + dy;
+                    if (qy < 0 || qy >= height) continue;
+                    for (int dx = -1; dx <= 1; dx++) {
+                        int qx = x + dx;
+                        if (qx < 0 || qx >= width) continue;
+                        float weight = float((2 - std::abs(dx)) * (2 - std::abs(dy)));
+                        sum += weight * variance[size_t(qy) * width + qx];
+                        weights += weight;
+                    }
+                }
+                inverseSigma[size_t(y) * width + x] = 1 / (colorSigma * std::sqrt(std::fmax(0.0f, sum / weights)) + 1e-4f);
+            }
+        }
+    }
+
+    void FilterRows(const Planes& input, Planes& output, int step, int y0, int y1) const {
+        for (int y = y0; y < y1; y++) {
+            int x = 0;
+#if defined(__AVX2__)
+            // Vectors whose taps all land inside the row; the edges go through FilterPixel
+            int margin = 2 * step;
+            for (; x < margin && x < width; x++) FilterPixel(input, output, step, x, y);
+            for (; x + 8 + margin <= width; x += 8) FilterEight(input, output, step, x, y);
+#endif
+            for (; x < width; x++) FilterPixel(input, output, step, x, y);
+        }
+    }
+
+    void FilterPixel(const Planes& input, Planes& output, int step, int x, int y) const {
+        size_t p = size_t(y) * width + x;
+        float luminance = Luminance(input[0][p], input[1][p], input[2][p]);
+        float depthScale = 1 / (depthSigma * guide[DepthSlope][p] * step + 1e-4f);
+
+        float center = kernel[2] * kernel[2];
+        float weights = center, variance = center * center * input[3][p];
+        float sum[3] = { center * input[0][p], center * input[1][p], center * input[2][p] };
+
+        for (int dy = -2; dy <= 2; dy++) {
+            int qy = y + dy * step;
+            if (qy < 0 || qy >= height) continue;
+            for (int dx = -2; dx <= 2; dx++) {
+                int qx = x + dx * step;
+                if ((dx == 0 && dy == 0) || qx < 0 || qx >= width) continue;
+                size_t q = size_t(qy) * width + qx;
+
+                float cosine = std::fmax(0.0f, guide[NormalX][p] * guide[NormalX][q] + guide[NormalY][p] * guide[NormalY][q] + guide[NormalZ][p] * guide[NormalZ][q]);
+                for (int squaring = 0; squaring < 7; squaring++) cosine *= cosine; // cos^128
+
+                float luminanceDistance = std::fabs(luminance - Luminance(input[0][q], input[1][q], input[2][q])) * inverseSigma[p];
+                float depthDistance = std::fabs(guide[Depth][p] - guide[Depth][q]) * depthScale * TapInverseDistance(dx, dy);
+                float weight = kernel[dx + 2] * kernel[dy + 2] * cosine * std::exp(-luminanceDistance - depthDistance);
+
+                weights += weight;
+                variance += weight * weight * input[3][q];
+                for (int channel = 0; channel < 3; channel++) sum[channel] += weight * input[channel][q];
+            }
+        }
+
+        for (int channel = 0; channel < 3; channel++) output[channel][p] = sum[channel] / weights;
+        output[3][p] = variance / (weights * weights);
+    }
+
+    static float TapInverseDistance(int dx, int dy) {
+        return 1 / std::sqrt(float(dx * dx + dy * dy));
+    }
+
+#if defined(__AVX2__)
+    static __m256 MultiplyAdd(__m256 a, __m256 b, __m256 c) {
+#if defined(__FMA__) || defined(_MSC_VER)
+        return _mm256_fmadd_ps(a, b, c);
+#else
+        return _mm256_add_ps(_mm256_mul_ps(a, b), c);
+#endif
+    }
+
+    static __m256 Luminance8(__m256 r, __m256 g, __m256 b) {
+        return MultiplyAdd(_mm256_set1_ps(0.2126f), r, MultiplyAdd(_mm256_set1_ps(0.7152f), g, _mm256_mul_ps(_mm256_set1_ps(0.0722f), b)));
+    }
+
+    // e^x for x <= 0: 2^(x log2 e) split into an integer power, built in the exponent bits, and
+    // a degree-5 polynomial for the fraction (relative error about 2e-7)
+    static __m256 ExpNegative8(__m256 x) {
+        x = _mm256_max_ps(x, _mm256_set1_ps(-87.0f));
+        __m256 t = _mm256_mul_ps(x, _mm256_set1_ps(1.44269504f));
+        __m256 whole = _mm256_floor_ps(t);
+        __m256 f = _mm256_sub_ps(t, whole);
+
+        __m256 p = _mm256_set1_ps(1.8753671e-3f);
+        p = MultiplyAdd(p, f, _mm256_set1_ps(8.9873484e-3f));
+        p = MultiplyAdd(p, f, _mm256_set1_ps(5.5835818e-2f));
+        p = MultiplyAdd(p, f, _mm256_set1_ps(2.4014658e-1f));
+        p = MultiplyAdd(p, f, _mm256_set1_ps(6.9315472e-1f));
+        p = MultiplyAdd(p, f, _mm256_set1_ps(9.9999984e-1f));
+
+        __m256i exponent = _mm256_slli_epi32(_mm256_cvtps_epi32(whole), 23);
+        return _mm256_castsi256_ps(_mm256_add_epi32(_mm256_castps_si256(p), exponent));
+    }
+
+    // FilterPixel for pixels x..x+7 of row y, all of whose taps are within the row
+    void FilterEight(const Planes& input, Planes& output, int step, int x, int y) const {
+        size_t p = size_t(y) * width + x;
+        const __m256 zero = _mm256_setzero_ps();
+        const __m256 signMask = _mm256_set1_ps(-0.0f);
+
+        __m256 luminance = Luminance8(_mm256_loadu_ps(&input[0][p]), _mm256_loadu_ps(&input[1][p]), _mm256_loadu_ps(&input[2][p]));
+        __m256 depthScale = _mm256_div_ps(_mm256_set1_ps(1.0f),
+            MultiplyAdd(_mm256_set1_ps(depthSigma * step), _mm256_loadu_ps(&guide[DepthSlope][p]), _mm256_set1_ps(1e-4f)));
+        __m256 sigma = _mm256_loadu_ps(&inverseSigma[p]);
+        __m256 normalX = _mm256_loadu_ps(&guide[NormalX][p]);
+        __m256 normalY = _mm256_loadu_ps(&guide[NormalY][p]);
+        __m256 normalZ = _mm256_loadu_ps(&guide[NormalZ][p]);
+        __m256 depth = _mm256_loadu_ps(&guide[Depth][p]);
+
+        __m256 center = _mm256_set1_ps(kernel[2] * kernel[2]);
+        __m256 weights = center;
+        __m256 variance = _mm256_mul_ps(_mm256_mul_ps(center, center), _mm256_loadu_ps(&input[3][p]));
+        __m256 sumR = _mm256_mul_ps(center, _mm256_loadu_ps(&input[0][p]));
+        __m256 sumG = _mm256_mul_ps(center, _mm256_loadu_ps(&input[1][p]));
+        __m256 sumB = _mm256_mul_ps(center, _mm256_loadu_ps(&input[2][p]));
+
+        for (int dy = -2; dy <= 2; dy++) {
+            int qy = y + dy * step;
+            if (qy < 0 || qy >= height) continue;
+            for (int dx = -2; dx <= 2; dx++) {
+                if (dx == 0 && dy == 0) continue;
+                size_t q = size_t(qy) * width + x + dx * step;
+
+                __m256 cosine = _mm256_mul_ps(normalX, _mm256_loadu_ps(&guide[NormalX][q]));
+                cosine = MultiplyAdd(normalY, _mm256_loadu_ps(&guide[NormalY][q]), cosine);
+                cosine = MultiplyAdd(normalZ, _mm256_loadu_ps(&guide[NormalZ][q]), cosine);
+                cosine = _mm256_max_ps(cosine, zero);
+                for (int squaring = 0; squaring < 7; squaring++) cosine = _mm256_mul_ps(cosine, cosine);
+
+                __m256 r = _mm256_loadu_ps(&input[0][q]);
+                __m256 g = _mm256_loadu_ps(&input[1][q]);
+                __m256 b = _mm256_loadu_ps(&input[2][q]);
+                __m256 luminanceDistance = _mm256_mul_ps(_mm256_andnot_ps(signMask, _mm256_sub_ps(luminance, Luminance8(r, g, b))), sigma);
+                __m256 depthDistance = _mm256_mul_ps(_mm256_andnot_ps(signMask, _mm256_sub_ps(depth, _mm256_loadu_ps(&guide[Depth][q]))),
+                    _mm256_mul_ps(depthScale, _mm256_set1_ps(TapInverseDistance(dx, dy))));
+                __m256 weight = _mm256_mul_ps(_mm256_mul_ps(_mm256_set1_ps(kernel[dx + 2] * kernel[dy + 2]), cosine),
+                    ExpNegative8(_mm256_sub_ps(zero, _mm256_add_ps(luminanceDistance, depthDistance))));
+
+                weights = _mm256_add_ps(weights, weight);
+                variance = MultiplyAdd(_mm256_mul_ps(weight, weight), _mm256_loadu_ps(&input[3][q]), variance);
+                sumR = MultiplyAdd(weight, r, sumR);
+                sumG = MultiplyAdd(weight, g, sumG);
+                sumB = MultiplyAdd(weight, b, sumB);
+            }
+        }
+
+        __m256 inverseWeights = _mm256_div_ps(_mm256_set1_ps(1.0f), weights);
+        _mm256_storeu_ps(&output[0][p], _mm256_mul_ps(sumR, inverseWeights));
+        _mm256_storeu_ps(&output[1][p], _mm256_mul_ps(sumG, inverseWeights));
+        _mm256_storeu_ps(&output[2][p], _mm256_mul_ps(sumB, inverseWeights));
+        _mm256_storeu_ps(&output[3][p], _mm256_mul_ps(variance, _mm256_mul_ps(inverseWeights, inverseWeights)));
+    }
+#endif
+};
+
+#endif
@@ -0,0 +1,508 @@
+#ifndef DISTRIBUTED_H
+#define DISTRIBUTED_H
+
+#if defined(_WIN32)
+#define NOMINMAX
+#include <winsock2.h>
+#include <ws2tcpip.h>
+#pragma comment(lib, "ws2_32.lib")
+#else
+#include <netdb.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <unistd.h>
+#endif
+
+#include "AccumulationBuffer.h"
+#include "Camera.h"
+#include "Hittable.h"
+#include "ThreadPool.h"
+
+#include <chrono>
+#include <cstring>
+#include <deque>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <vector>
+
+// Rendering one image across several processes or machines over TCP. A RenderCoordinator
+// splits the image into tile jobs (Camera::BeginJobs) and hands them to the RenderWorkers that
+// connect to it; each worker renders its jobs into float tiles with their sample counts and
+// sends them back to be merged. A worker that disconnects, or holds a job for longer than
+// jobTimeout, is dropped and its jobs go back to the front of the queue. The coordinator
+// checkpoints and writes the image as Render would, and the result is identical to rendering
+// locally.
+//
+// Every process must be started with the same scene. The coordinator checks each worker's
+// image and camera settings and its Camera::sceneFingerprint when it connects, so a worker
+// loaded from a different scene file is turned away. Messages are raw structs, so the
+// machines must agree on endianness.
+
+// A TCP socket, closed when it goes out of scope
+class Socket {
+public:
+#if defined(_WIN32)
+    using Handle = SOCKET;
+    static constexpr Handle invalidHandle = INVALID_SOCKET;
+#else
+    using Handle = int;
+    static constexpr Handle invalidHandle = -1;
+#endif
+
+    Socket() = default;
+    explicit Socket(Handle handle) : handle(handle) {}
+    Socket(Socket&& other) noexcept : handle(other.handle) { other.handle = invalidHandle; }
+    Socket& operator=(Socket&& other) noexcept {
+        std::swap(handle, other.handle);
+        return *this;
+    }
+    ~Socket() { Close(); }
+
+    bool Valid() const { return handle != invalidHandle; }
+    Handle Native() const { return handle; }
+
+    void Close() {
+        if (!Valid()) return;
+#if defined(_WIN32)
+        closesocket(handle);
+#else
+        close(handle);
+#endif
+        handle = invalidHandle;
+    }
+
+    // Accepts connections on every interface
+    static Socket Listen(uint16_t port) {
+        StartNetwork();
+        Socket socket(::socket(AF_INET, SOCK_STREAM, IPPROTO_TCP));
+        if (!socket.Valid()) return socket;
+
+        int reuse = 1;
+        setsockopt(socket.handle, SOL_SOCKET, SO_REUSEADDR, reinterpret_cast<const char*>(&reuse), sizeof(reuse));
+        sockaddr_in address = {};
+        address.sin_family = AF_INET;
+        address.sin_addr.s_addr = htonl(INADDR_ANY);
+        address.sin_port = htons(port);
+        if (bind(socket.handle, reinterpret_cast<const sockaddr*>(&address), sizeof(address)) != 0 || listen(socket.handle, 64) != 0)
+            socket.Close();
+        return socket;
+    }
+
+    Socket Accept() const {
+        Socket client(accept(handle, nullptr, nullptr));
+        if (client.Valid()) client.Configure();
+        return client;
+    }
+
+    static Socket Connect(const std::string& host, uint16_t port) {
+        StartNetwork();
+        addrinfo hints = {};
+        hints.ai_family = AF_UNSPEC;
+        hints.ai_socktype = SOCK_STREAM;
+        addrinfo* addresses = nullptr;
+        if (getaddrinfo(host.c_str(), std::to_string(port).c_str(), &hints, &addresses) != 0) return Socket();
+
+        Socket socket;
+        for (addrinfo* address = addresses; address && !socket.Valid(); address = address->ai_next) {
+            socket = Socket(::socket(address->ai_family, address->ai_socktype, address->ai_protocol));
+            if (socket.Valid() && connect(socket.handle, address->ai_addr, int(address->ai_addrlen)) != 0) socket.Close();
+        }
+        freeaddrinfo(addresses);
+        if (socket.Valid()) socket.Configure();
+        return socket;
+    }
+
+    bool Send(const void* data, size_t size) {
+        const char* bytes = static_cast<const char*>(data);
+        while (size > 0) {
+            int chunk = int(std::min<size_t>(size, 1 << 30));
+#if defined(MSG_NOSIGNAL)
+            auto sent = send(handle, bytes, chunk, MSG_NOSIGNAL); // A closed peer is an error, not SIGPIPE
+#else
+            auto sent = send(handle, bytes, chunk, 0);
+#endif
+            if (sent <= 0) return false;
+            bytes += sent;
+            size -= size_t(sent);
+        }
+        return true;
+    }
+
+    bool Receive(void* data, size_t size) {
+        char* bytes = static_cast<char*>(data);
+        while (size > 0) {
+            auto received = recv(handle, bytes, int(std::min<size_t>(size, 1 << 30)), 0);
+            if (received <= 0) return false;
+            bytes += received;
+            size -= size_t(received);
+        }
+        return true;
+    }
+
+    // One read of up to 'size' bytes, which doesn't block once poll has reported the socket
+    // readable. Returns the bytes read, or 0 or less if the peer is gone.
+    long ReceiveSome(void* data, size_t size) {
+        return long(recv(handle, static_cast<char*>(data), int(std::min<size_t>(size, 1 << 30)), 0));
+    }
+
+private:
+    Handle handle = invalidHandle;
+
+    void Configure() {
+        int noDelay = 1; // Jobs are small messages that shouldn't wait to be batched
+        setsockopt(handle, IPPROTO_TCP, TCP_NODELAY, reinterpret_cast<const char*>(&noDelay), sizeof(noDelay));
+#if defined(__APPLE__)
+        int noSignal = 1;
+        setsockopt(handle, SOL_SOCKET, SO_NOSIGPIPE, &noSignal, sizeof(noSignal));
+#endif
+    }
+
+    static void StartNetwork() {
+#if defined(_WIN32)
+        static bool started = [] {
+            WSADATA data;
+            return WSAStartup(MAKEWORD(2, 2), &data) == 0;
+        }();
+        (void)started;
+#endif
+    }
+};
+
+// Framing shared by the coordinator and the workers: a header, then 'size' bytes of payload
+enum class MessageType : uint32_t {
+    Hello,  // Worker to coordinator: RenderSettings
+    Job,    // Coordinator to worker: a Camera::TileJob
+    Result, // Worker to coordinator: JobCounts, then the tile's AccumulationBuffer::WriteData
+    Done,   // Coordinator to worker: no more jobs
+};
+
+struct MessageHeader {
+    uint32_t type;
+    uint32_t job;
+    uint64_t size;
+};
+
+// What a worker must share with the coordinator for its tiles to belong in the image
+struct RenderSettings {
+    uint32_t magic;
+    uint32_t version;
+    int32_t width;
+    int32_t height;
+    int32_t samplesPerPixel;
+    int32_t maxDepth;
+    int32_t rouletteDepth;
+    int32_t samplerType;
+    uint64_t seed;
+    uint64_t scene; // Camera::sceneFingerprint
+    uint32_t features;
+    uint32_t skyLight;
+    uint32_t adaptiveSampling;
+    double timeBudget;
+    double verticalFov;
+    double defocusAngle;
+    double focusDistance;
+    double view[9]; // lookFrom, lookAt, up
+
+    bool operator==(const RenderSettings&) const = default;
+
+    static constexpr uint32_t currentMagic = 0x4b535452; // "RTSK"
+    static constexpr uint32_t currentVersion = 3;
+
+    static RenderSettings Of(const Camera& camera) {
+        // Zeroed whole, as the struct is sent as raw bytes and mustn't carry stale padding
+        RenderSettings settings;
+        std::memset(&settings, 0, sizeof(settings));
+        settings.magic = currentMagic;
+        settings.version = currentVersion;
+        settings.width = camera.imageWidth;
+        settings.height = camera.ImageHeight();
+        settings.samplesPerPixel = camera.samplesPerPixel;
+        settings.maxDepth = camera.maxDepth;
+        settings.rouletteDepth = camera.rouletteDepth;
+        settings.samplerType = int32_t(camera.samplerType);
+        settings.seed = camera.seed;
+        settings.scene = camera.sceneFingerprint;
+        settings.features = camera.writeFeatures || camera.denoise;
+        settings.skyLight = camera.skyLight;
+        settings.adaptiveSampling = camera.adaptiveSampling;
+        settings.timeBudget = camera.timeBudget;
+        settings.verticalFov = camera.verticalFov;
+        settings.defocusAngle = camera.defocusAngle;
+        settings.focusDistance = camera.focusDistance;
+        for (int axis = 0; axis < 3; axis++) {
+            settings.view[axis] = camera.lookFrom[axis];
+            settings.view[3 + axis] = camera.lookAt[axis];
+            settings.view[6 + axis] = camera.up[axis];
+        }
+        return settings;
+    }
+};
+
+struct JobCounts {
+    uint64_t primaryRays;
+    uint64_t secondaryRays;
+    uint64_t shadowRays;
+};
+
+inline bool SendMessage(Socket& socket, MessageType type, uint32_t job, const void* payload = nullptr, size_t size = 0) {
+    MessageHeader header = { uint32_t(type), job, size };
+    return socket.Send(&header, sizeof(header)) && socket.Send(payload, size);
+}
+
+// Blocks until a whole message has arrived; one with more than maxPayload bytes is an error
+inline bool ReceiveMessage(Socket& socket, MessageHeader& header, std::string& payload, size_t maxPayload) {
+    if (!socket.Receive(&header, sizeof(header)) || header.size > maxPayload) return false;
+    payload.resize(size_t(header.size));
+    return socket.Receive(payload.data(), payload.size());
+}
+
+class RenderCoordinator {
+public:
+    int jobSize = 64;         // Tile edge in pixels; each job is one tile with all its samples
+    int jobsPerWorker = 2;    // Kept in flight per worker so it never waits for its next job
+    double jobTimeout = 600;  // Seconds a worker may go without returning a job before it is dropped
+
+    explicit RenderCoordinator(uint16_t port) : port(port) {}
+
+    // Renders camera's image with whatever workers connect, then resolves and writes it. Returns
+    // false if the camera's settings or checkpoint can't be split into jobs (see
+    // Camera::BeginJobs) or the port can't be opened.
+    bool Render(Camera& camera) {
+        vector<Camera::TileJob> jobs;
+        string error;
+        if (!camera.BeginJobs(jobSize, jobs, error)) {
+            cerr << error << "\n";
+            return false;
+        }
+
+        Socket listener = Socket::Listen(port);
+        if (!listener.Valid()) {
+            cerr << "Could not listen on port " << port << "\n";
+            return false;
+        }
+
+        RenderSettings settings = RenderSettings::Of(camera);
+        // The largest result a worker can send; any bigger message is dropped unread
+        size_t maxResult = sizeof(JobCounts) + AccumulationBuffer::DataSize(jobSize, jobSize, camera.writeFeatures || camera.denoise);
+        vector<char> received(1 << 20);
+        vector<char> done(jobs.size(), 0);
+        deque<uint32_t> queue;
+        for (uint32_t job = 0; job < jobs.size(); job++) queue.push_back(job);
+        size_t remaining = jobs.size();
+        size_t reportedRemaining = 0, reportedWorkers = 0;
+
+        vector<Connection> workers;
+        clog << "Waiting for workers on port " << port << " to render " << jobs.size() << " tiles\n";
+        auto renderStart = chrono::steady_clock::now();
+
+        // Drops a worker and puts whatever it was holding back at the front of the queue
+        auto drop = [&](size_t index, const char* reason) {
+            clog << "\nDropping worker " << workers[index].id << ": " << reason << "\n";
+            for (uint32_t job : workers[index].jobs)
+                if (!done[job]) queue.push_front(job);
+            workers.erase(workers.begin() + index);
+        };
+
+        while (remaining > 0) {
+            vector<pollfd> polled(1 + workers.size());
+            polled[0] = { listener.Native(), POLLIN, 0 };
+            for (size_t i = 0; i < workers.size(); i++) polled[1 + i] = { workers[i].socket.Native(), POLLIN, 0 };
+            Poll(polled, 1000);
+
+            if (polled[0].revents & POLLIN) {
+                Socket socket = listener.Accept();
+                if (socket.Valid()) workers.push_back({ std::move(socket), nextWorkerId++, false, {}, chrono::steady_clock::now(), {} });
+            }
+
+            // Walk backwards so dropping a worker doesn't disturb the ones still to visit
+            auto now = chrono::steady_clock::now();
+            for (size_t i = workers.size(); i-- > 0;) {
+                Connection& worker = workers[i];
+                if (i + 1 < polled.size() && polled[1 + i].revents) {
+                    // A single read, so a worker that stalls mid-message holds up no one else
+                    long size = worker.socket.ReceiveSome(received.data(), received.size());
+                    if (size <= 0) {
+                        drop(i, "disconnected");
+                        continue;
+                    }
+                    worker.inbox.append(received.data(), size_t(size));
+                    if (const char* problem = HandleMessages(camera, jobs, settings, maxResult, worker, done, remaining)) {
+                        drop(i, problem);
+                        continue;
+                    }
+                }
+                // Checked even while bytes arrive, so a worker can't hold its jobs by trickling them
+                if (!worker.jobs.empty() && chrono::duration<double>(now - worker.lastHeard).count() > jobTimeout) {
+                    drop(i, "timed out");
+                    continue;
+                }
+
+                while (worker.ready && int(worker.jobs.size()) < jobsPerWorker && !queue.empty()) {
+                    uint32_t job = queue.front();
+                    queue.pop_front();
+                    if (done[job]) continue;
+                    if (worker.jobs.empty()) worker.lastHeard = now; // The timeout runs from its first job
+                    worker.jobs.push_back(job);
+                    if (!SendMessage(worker.socket, MessageType::Job, job, &jobs[job], sizeof(jobs[job]))) {
+                        drop(i, "disconnected");
+                        break;
+                    }
+                }
+            }
+            if (remaining != reportedRemaining || workers.size() != reportedWorkers) {
+                clog << "\rTiles remaining: " << remaining << " on " << workers.size() << " workers   " << flush;
+                reportedRemaining = remaining;
+                reportedWorkers = workers.size();
+            }
+        }
+
+        for (Connection& worker : workers) SendMessage(worker.socket, MessageType::Done, 0);
+        camera.FinishJobs(chrono::duration<double>(chrono::steady_clock::now() - renderStart).count());
+        return true;
+    }
+
+private:
+    struct Connection {
+        Socket socket;
+        int id;
+        bool ready;                  // Said hello with matching settings
+        vector<uint32_t> jobs;       // Sent and not yet returned
+        chrono::steady_clock::time_point lastHeard; // When its last whole message arrived
+        string inbox;                // Received bytes not yet making up a whole message
+    };
+
+    uint16_t port;
+    int nextWorkerId = 1;
+
+    static void Poll(vector<pollfd>& sockets, int milliseconds) {
+#if defined(_WIN32)
+        WSAPoll(sockets.data(), ULONG(sockets.size()), milliseconds);
+#else
+        poll(sockets.data(), nfds_t(sockets.size()), milliseconds);
+#endif
+    }
+
+    // Handles every whole message in the worker's inbox, leaving a partial one for later reads.
+    // Returns why the worker should be dropped, or nullptr.
+    static const char* HandleMessages(Camera& camera, const vector<Camera::TileJob>& jobs, const RenderSettings& settings,
+        size_t maxResult, Connection& worker, vector<char>& done, size_t& remaining) {
+        size_t consumed = 0;
+        const char* problem = nullptr;
+        while (!problem && worker.inbox.size() - consumed >= sizeof(MessageHeader)) {
+            MessageHeader header;
+            memcpy(&header, worker.inbox.data() + consumed, sizeof(header));
+            uint64_t maxPayload = header.type == uint32_t(MessageType::Hello) ? sizeof(RenderSettings)
+                : header.type == uint32_t(MessageType::Result) ? maxResult : 0;
+            if (header.size > maxPayload) {
+                problem = "sent an oversized message";
+                break;
+            }
+            if (worker.inbox.size() - consumed - sizeof(header) < header.size) break;
+            string payload = worker.inbox.substr(consumed + sizeof(header), size_t(header.size));
+            consumed += sizeof(header) + size_t(header.size);
+            worker.lastHeard = chrono::steady_clock::now();
+
+            if (header.type == uint32_t(MessageType::Hello)) {
+                RenderSettings workerSettings;
+                if (payload.size() != sizeof(workerSettings)) {
+                    problem = "not a worker";
+                    break;
+                }
+                memcpy(&workerSettings, payload.data(), sizeof(workerSettings));
+                if (!(workerSettings == settings)) {
+                    problem = "its scene, image or camera settings differ";
+                    break;
+                }
+                worker.ready = true;
+                clog << "\nWorker " << worker.id << " connected\n";
+            }
+            else if (header.type == uint32_t(MessageType::Result) && !Merge(camera, jobs, header.job, payload, worker, done, remaining)) {
+                problem = "sent a bad result";
+            }
+        }
+        worker.inbox.erase(0, consumed);
+        return problem;
+    }
+
+    // Adds a returned tile to the image. Only jobs the worker was actually given are accepted.
+    static bool Merge(Camera& camera, const vector<Camera::TileJob>& jobs, uint32_t index, const string& payload,
+        Connection& worker, vector<char>& done, size_t& remaining) {
+        auto held = find(worker.jobs.begin(), worker.jobs.end(), index);
+        if (held == worker.jobs.end() || payload.size() < sizeof(JobCounts)) return false;
+        worker.jobs.erase(held);
+
+        const Camera::TileJob& job = jobs[index];
+        JobCounts counts;
+        memcpy(&counts, payload.data(), sizeof(counts));
+        AccumulationBuffer tile;
+        tile.Reset(job.x1 - job.x0, job.y1 - job.y0, camera.writeFeatures || camera.denoise);
+        istringstream in(payload.substr(sizeof(counts)));
+        if (!tile.ReadData(in) || in.peek() != EOF) return false;
+
+        RenderStatistics jobStatistics;
+        jobStatistics.primaryRays = counts.primaryRays;
+        jobStatistics.secondaryRays = counts.secondaryRays;
+        jobStatistics.shadowRays = counts.shadowRays;
+        camera.MergeJob(job, tile, jobStatistics);
+        done[index] = 1;
+        remaining--;
+        return true;
+    }
+};
+
+class RenderWorker {
+public:
+    double connectTimeout = 30; // Seconds to keep retrying while the coordinator starts up
+
+    // Renders jobs from the coordinator at host:port until it says it is done. Returns false if
+    // the coordinator can't be reached or goes away.
+    bool Run(const string& host, uint16_t port, Camera& camera, const Hittable& world) {
+        Socket socket;
+        auto start = chrono::steady_clock::now();
+        while (!(socket = Socket::Connect(host, port)).Valid()) {
+            if (chrono::duration<double>(chrono::steady_clock::now() - start).count() > connectTimeout) {
+                cerr << "Could not connect to " << host << ":" << port << "\n";
+                return false;
+            }
+            this_thread::sleep_for(chrono::milliseconds(250));
+        }
+
+        camera.PrepareJobs(world);
+        RenderSettings settings = RenderSettings::Of(camera);
+        if (!SendMessage(socket, MessageType::Hello, 0, &settings, sizeof(settings))) return false;
+
+        ThreadPool pool(camera.threadCount);
+        clog << "Connected to " << host << ":" << port << ", rendering on " << pool.ThreadCount() << " threads\n";
+        int jobCount = 0;
+        MessageHeader header;
+        string payload;
+        while (ReceiveMessage(socket, header, payload, sizeof(Camera::TileJob))) {
+            if (header.type == uint32_t(MessageType::Done)) {
+                clog << "Rendered " << jobCount << " tiles\n";
+                return true;
+            }
+            if (header.type != uint32_t(MessageType::Job) || payload.size() != sizeof(Camera::TileJob)) break;
+
+            Camera::TileJob job;
+            memcpy(&job, payload.data(), sizeof(job));
+            AccumulationBuffer tile;
+            tile.Reset(job.x1 - job.x0, job.y1 - job.y0, camera.writeFeatures || camera.denoise);
+            RenderStatistics jobStatistics = camera.RenderJob(job, world, tile, pool);
+
+            JobCounts counts = { jobStatistics.primaryRays, jobStatistics.secondaryRays, jobStatistics.shadowRays };
+            ostringstream out;
+            out.write(reinterpret_cast<const char*>(&counts), sizeof(counts));
+            tile.WriteData(out);
+            string result = out.str();
+            if (!SendMessage(socket, MessageType::Result, header.job, result.data(), result.size())) break;
+            jobCount++;
+        }
+        cerr << "Lost the coordinator after " << jobCount << " tiles\n";
+        return false;
+    }
+};
+
+#endif
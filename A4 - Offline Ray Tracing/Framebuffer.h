@@ -0,0 +1,46 @@
+#ifndef FRAMEBUFFER_H
+#define FRAMEBUFFER_H
+
+#include "RTWeekend.h"
+
+#include <vector>
+
+// Linear float RGB image the tile renderer writes into. Pixels are stored row-major from the
+// top-left with the three channels interleaved, so a whole frame can be converted in one pass.
+class Framebuffer {
+public:
+    Framebuffer() {}
+    Framebuffer(int width, int height) { Resize(width, height); }
+
+    void Resize(int newWidth, int newHeight) {
+        width = newWidth;
+        height = newHeight;
+        data.assign(size_t(width) * height * 3, 0.0f);
+    }
+
+    int Width() const { return width; }
+    int Height() const { return height; }
+    size_t PixelCount() const { return size_t(width) * height; }
+
+    void Set(int x, int y, const Color& color) {
+        float* pixel = &data[(size_t(y) * width + x) * 3];
+        pixel[0] = float(color.x());
+        pixel[1] = float(color.y());
+        pixel[2] = float(color.z());
+    }
+
+    Color Get(int x, int y) const {
+        const float* pixel = &data[(size_t(y) * width + x) * 3];
+        return Color(pixel[0], pixel[1], pixel[2]);
+    }
+
+    float* Data() { return data.data(); }
+    const float* Data() const { return data.data(); }
+
+private:
+    int width = 0;
+    int height = 0;
+    std::vector<float> data;
+};
+
+#endif
@@ -1,18 +1,42 @@
 #ifndef HITTABLE_H
 #define HITTABLE_H
 
+#include "AABB.h"
 #include "RTWeekend.h"
+#include "Statistics.h"
 
-class Material;
+#include <cstdint>
+
+class Hittable;
+class LightList;
+
+// How primitives and materials are called. ClosedWorld stores the built-in types by value and
+// switches on a tag; Virtual goes through the Hittable and Material interfaces for everything.
+enum class Dispatch {
+    ClosedWorld,
+    Virtual,
+};
 
 class HitRecord {
 public:
+    // Written by Hit: only what's needed to find the closest hit and come back to it
+    double t;
+    const Hittable* object = nullptr; // The primitive that was hit, never a container
+    uint32_t primitiveId = 0;         // Which of the object's primitives, for objects holding many
+    double u = 0, v = 0;              // Surface coordinates, for primitives that have them
+    const Hittable* instancedObject = nullptr; // When 'object' is an Instance, the object inside it that was hit
+
+    // Written by Hittable::ComputeSurface, once, for the closest hit
     Point3 point;
     Vector3 normal;
-    shared_ptr<Material> material;
-    double t;
+    uint32_t materialId = 0; // Index into MaterialTable::Global()
     bool frontFace;
 
+    // Written by Hittable::ComputeTextureCoordinates, only for materials that use a texture
+    double textureU = 0, textureV = 0;
+    double textureScale = 0; // Texture units per world unit at the point, for picking a mip level
+    double footprint = 0;    // Width of the ray's cone where it meets the surface, set by the Camera
+
     void SetFaceNormal(const Ray& ray, const Vector3& outwardNormal) {
         // Sets the hit record normal vector.
         // NOTE: The parameter 'outwardNormal' is assumed to have unit length.
@@ -26,7 +50,22 @@ class Hittable {
 public:
     virtual ~Hittable() = default;
 
+    // Finds the closest hit in rayT, filling only t, object, primitiveId and u, v
     virtual bool Hit(const Ray& ray, Interval rayT, HitRecord& record) const = 0;
+
+    // Fills in the point, normal and material for a hit this object recorded. Containers pass
+    // hits through without owning them, so they never get this call.
+    virtual void ComputeSurface(const Ray& ray, HitRecord& record) const {}
+
+    // Fills in the texture coordinates after ComputeSurface, for the few hits whose material
+    // has a texture. Objects without a parameterization leave them at zero.
+    virtual void ComputeTextureCoordinates(const Ray& ray, HitRecord& record) const {}
+
+    // Adds the object's emissive primitives to 'lights' under the object and primitiveId its
+    // hits report. Containers forward to what they hold.
+    virtual void CollectLights(LightList& lights) const {}
+
+    virtual AABB BoundingBox() const = 0;
 };
 
 #endif
\ No newline at end of file
@@ -2,6 +2,8 @@
 #define HITTABLE_LIST_H
 
 #include "Hittable.h"
+#include "Sphere.h"
+#include "SphereSet.h"
 
 #include <vector>
 
@@ -12,27 +14,57 @@ public:
     HittableList() {}
     HittableList(shared_ptr<Hittable> object) { Add(object); }
 
-    void Clear() { objects.clear(); }
+    void Clear() {
+        objects.clear();
+        Precision precision = spheres.precision;
+        spheres = SphereSet();
+        spheres.precision = precision;
+        others.clear();
+        bbox = AABB();
+    }
 
     void Add(shared_ptr<Hittable> object) {
         objects.push_back(object);
+        bbox = AABB(bbox, object->BoundingBox());
+
+        // Spheres are also packed into a SoA set so the scan below tests them in batches
+        if (auto sphere = std::dynamic_pointer_cast<Sphere>(object))
+            spheres.Add(*sphere);
+        else
+            others.push_back(object);
     }
 
+    // Precision used for the packed spheres; see SphereSet
+    void SetPrecision(Precision precision) { spheres.precision = precision; }
+
     bool Hit(const Ray& ray, Interval rayT, HitRecord& record) const override {
-        HitRecord tempRecord;
-        bool hitAnything = false;
-        auto closestSoFar = rayT.max;
+        TRACE_COUNT(hitCalls);
+        // Hits only write the record when they beat rayT.max, so every object can share it
+        bool hitAnything = spheres.Hit(ray, rayT, record);
+        if (hitAnything) rayT.max = record.t;
 
-        for (const auto& object : objects) {
-            if (object->Hit(ray, Interval(rayT.min, closestSoFar), tempRecord)) {
+        for (const auto& object : others) {
+            if (object->Hit(ray, rayT, record)) {
                 hitAnything = true;
-                closestSoFar = tempRecord.t;
-                record = tempRecord;
+                rayT.max = record.t;
             }
         }
 
         return hitAnything;
     }
+
+    void CollectLights(LightList& lights) const override {
+        spheres.CollectLights(lights);
+        for (const auto& object : others)
+            object->CollectLights(lights);
+    }
+
+    AABB BoundingBox() const override { return bbox; }
+
+private:
+    SphereSet spheres;
+    std::vector<shared_ptr<Hittable>> others;
+    AABB bbox;
 };
 
 #endif
\ No newline at end of file
@@ -0,0 +1,361 @@
+#ifndef IMAGE_IO_H
+#define IMAGE_IO_H
+
+#include "Color.h"
+#include "Framebuffer.h"
+
+#include <bit>
+#include <cctype>
+#include <charconv>
+#include <cstdint>
+#include <cstring>
+#include <fstream>
+#include <iterator>
+#include <string>
+#include <type_traits>
+#include <vector>
+
+// Every encoder builds the complete file in memory so it reaches the disk in a single write.
+// ReadImage reads the PPM and PFM variants back, for textures.
+enum class ImageFormat {
+    PPMText,   // P3, 8-bit gamma-corrected ASCII (the original output)
+    PPM,       // P6, 8-bit gamma-corrected binary
+    PFM,       // Linear 32-bit float
+    EXR,       // Linear 16-bit half float, uncompressed OpenEXR scanlines
+};
+
+inline ImageFormat ImageFormatFromPath(const std::string& path) {
+    auto endsWith = [&](const char* extension) {
+        size_t length = std::strlen(extension);
+        return path.size() >= length && path.compare(path.size() - length, length, extension) == 0;
+    };
+    if (endsWith(".pfm")) return ImageFormat::PFM;
+    if (endsWith(".exr")) return ImageFormat::EXR;
+    return ImageFormat::PPM;
+}
+
+namespace ImageIO {
+    inline void Append(std::vector<char>& buffer, const void* bytes, size_t size) {
+        const char* begin = static_cast<const char*>(bytes);
+        buffer.insert(buffer.end(), begin, begin + size);
+    }
+
+    inline void Append(std::vector<char>& buffer, const std::string& text) {
+        Append(buffer, text.data(), text.size());
+    }
+
+    // Files are little-endian regardless of the host
+    template <typename T>
+    inline void AppendLittleEndian(std::vector<char>& buffer, T value) {
+        static_assert(std::is_integral_v<T>);
+        for (size_t i = 0; i < sizeof(T); i++)
+            buffer.push_back(char((uint64_t(value) >> (8 * i)) & 0xff));
+    }
+
+    inline void AppendLittleEndian(std::vector<char>& buffer, float value) {
+        AppendLittleEndian(buffer, std::bit_cast<uint32_t>(value));
+    }
+
+    // Bulk version for arrays; a plain copy on little-endian hosts
+    template <typename T>
+    inline void AppendLittleEndian(std::vector<char>& buffer, const T* values, size_t count) {
+        if constexpr (std::endian::native == std::endian::little) {
+            Append(buffer, values, count * sizeof(T));
+        }
+        else {
+            for (size_t i = 0; i < count; i++)
+                AppendLittleEndian(buffer, values[i]);
+        }
+    }
+
+    inline std::vector<uint8_t> Quantize(const Framebuffer& image) {
+        std::vector<uint8_t> bytes(image.PixelCount() * 3);
+        QuantizeToBytes(image.Data(), bytes.size(), bytes.data());
+        return bytes;
+    }
+
+    // Round-to-nearest-even float to IEEE half conversion, saturating to infinity
+    inline uint16_t FloatToHalf(float value) {
+        uint32_t bits = std::bit_cast<uint32_t>(value);
+        uint32_t sign = (bits >> 16) & 0x8000u;
+        uint32_t magnitude = bits & 0x7fffffffu;
+
+        if (magnitude >= 0x7f800000u) // Inf or NaN
+            return uint16_t(sign | 0x7c00u | (magnitude > 0x7f800000u ? 0x200u : 0));
+        if (magnitude >= 0x477ff000u) // Rounds past the largest half
+            return uint16_t(sign | 0x7c00u);
+        if (magnitude < 0x38800000u) { // Half denormal or zero
+            if (magnitude < 0x33000000u) return uint16_t(sign);
+            uint32_t exponent = magnitude >> 23;
+            uint32_t mantissa = (magnitude & 0x7fffffu) | 0x800000u;
+            uint32_t shift = 126 - exponent;
+            uint32_t half = mantissa >> shift;
+            uint32_t remainder = mantissa & ((1u << shift) - 1);
+            uint32_t halfway = 1u << (shift - 1);
+            if (remainder > halfway || (remainder == halfway && (half & 1u))) half++;
+            return uint16_t(sign | half);
+        }
+
+        uint32_t half = ((magnitude - 0x38000000u) >> 13);
+        uint32_t remainder = magnitude & 0x1fffu;
+        if (remainder > 0x1000u || (remainder == 0x1000u && (half & 1u))) half++;
+        return uint16_t(sign | half);
+    }
+
+    inline std::vector<char> EncodePPMText(const Framebuffer& image) {
+        std::vector<uint8_t> bytes = Quantize(image);
+
+        std::vector<char> buffer;
+        buffer.reserve(bytes.size() * 4 + 32);
+        Append(buffer, "P3\n" + std::to_string(image.Width()) + ' ' + std::to_string(image.Height()) + "\n255\n");
+
+        char digits[4];
+        for (size_t i = 0; i < bytes.size(); i++) {
+            char* end = std::to_chars(digits, digits + sizeof(digits), int(bytes[i])).ptr;
+            Append(buffer, digits, size_t(end - digits));
+            buffer.push_back(i % 3 == 2 ? '\n' : ' ');
+        }
+        return buffer;
+    }
+
+    inline std::vector<char> EncodePPM(const Framebuffer& image) {
+        std::vector<uint8_t> bytes = Quantize(image);
+
+        std::vector<char> buffer;
+        Append(buffer, "P6\n" + std::to_string(image.Width()) + ' ' + std::to_string(image.Height()) + "\n255\n");
+        Append(buffer, bytes.data(), bytes.size());
+        return buffer;
+    }
+
+    inline std::vector<char> EncodePFM(const Framebuffer& image) {
+        std::vector<char> buffer;
+        // A negative scale marks the data as little-endian
+        Append(buffer, "PF\n" + std::to_string(image.Width()) + ' ' + std::to_string(image.Height()) + "\n-1.0\n");
+        buffer.reserve(buffer.size() + image.PixelCount() * 3 * sizeof(float));
+
+        // PFM stores scanlines bottom to top
+        size_t rowFloats = size_t(image.Width()) * 3;
+        for (int y = image.Height() - 1; y >= 0; y--)
+            AppendLittleEndian(buffer, image.Data() + size_t(y) * rowFloats, rowFloats);
+        return buffer;
+    }
+
+    inline void AppendAttribute(std::vector<char>& buffer, const char* name, const char* type, const std::vector<char>& value) {
+        Append(buffer, name, std::strlen(name) + 1);
+        Append(buffer, type, std::strlen(type) + 1);
+        AppendLittleEndian(buffer, int32_t(value.size()));
+        Append(buffer, value.data(), value.size());
+    }
+
+    // Single-part scanline OpenEXR with uncompressed HALF B, G, R channels (alphabetical, as the
+    // format requires), one scanline per chunk.
+    inline std::vector<char> EncodeEXR(const Framebuffer& image) {
+        int width = image.Width();
+        int height = image.Height();
+        std::vector<char> buffer;
+
+        const unsigned char magic[] = { 0x76, 0x2f, 0x31, 0x01 };
+        Append(buffer, magic, sizeof(magic));
+        AppendLittleEndian(buffer, int32_t(2)); // Version 2, single-part scanline
+
+        std::vector<char> value;
+        for (const char* channel : { "B", "G", "R" }) {
+            Append(value, channel, 2);
+            AppendLittleEndian(value, int32_t(1)); // HALF
+            AppendLittleEndian(value, int32_t(0)); // pLinear and reserved bytes
+            AppendLittleEndian(value, int32_t(1)); // x sampling
+            AppendLittleEndian(value, int32_t(1)); // y sampling
+        }
+        value.push_back(0);
+        AppendAttribute(buffer, "channels", "chlist", value);
+
+        AppendAttribute(buffer, "compression", "compression", { 0 });
+
+        value.clear();
+        for (int32_t coordinate : { 0, 0, width - 1, height - 1 })
+            AppendLittleEndian(value, coordinate);
+        AppendAttribute(buffer, "dataWindow", "box2i", value);
+        AppendAttribute(buffer, "displayWindow", "box2i", value);
+
+        AppendAttribute(buffer, "lineOrder", "lineOrder", { 0 }); // Increasing Y
+
+        value.clear();
+        AppendLittleEndian(value, 1.0f);
+        AppendAttribute(buffer, "pixelAspectRatio", "float", value);
+        AppendAttribute(buffer, "screenWindowWidth", "float", value);
+
+        value.clear();
+        AppendLittleEndian(value, 0.0f);
+        AppendLittleEndian(value, 0.0f);
+        AppendAttribute(buffer, "screenWindowCenter", "v2f", value);
+
+        buffer.push_back(0); // End of header
+
+        // Offset table, then each chunk: y, byte count, then every channel's row in turn
+        int32_t rowBytes = width * 3 * int32_t(sizeof(uint16_t));
+        uint64_t chunkStart = buffer.size() + size_t(height) * sizeof(uint64_t);
+        for (int y = 0; y < height; y++)
+            AppendLittleEndian(buffer, chunkStart + uint64_t(y) * (8 + rowBytes));
+
+        buffer.reserve(buffer.size() + size_t(height) * (8 + rowBytes));
+        std::vector<uint16_t> halves(size_t(width) * 3);
+        for (int y = 0; y < height; y++) {
+            AppendLittleEndian(buffer, int32_t(y));
+            AppendLittleEndian(buffer, rowBytes);
+
+            const float* row = image.Data() + size_t(y) * width * 3;
+            for (int channel = 0; channel < 3; channel++) {
+                uint16_t* plane = &halves[size_t(2 - channel) * width];
+                for (int x = 0; x < width; x++)
+                    plane[x] = FloatToHalf(row[size_t(x) * 3 + channel]);
+            }
+            AppendLittleEndian(buffer, halves.data(), halves.size());
+        }
+        return buffer;
+    }
+
+    inline std::vector<char> Encode(const Framebuffer& image, ImageFormat format) {
+        switch (format) {
+        case ImageFormat::PPMText: return EncodePPMText(image);
+        case ImageFormat::PFM: return EncodePFM(image);
+        case ImageFormat::EXR: return EncodeEXR(image);
+        default: return EncodePPM(image);
+        }
+    }
+}
+
+namespace ImageIO {
+    // Reads the next header field of a PPM or PFM, skipping whitespace and '#' comments
+    inline bool ReadHeaderWord(const std::vector<char>& file, size_t& position, std::string& word) {
+        while (position < file.size()) {
+            char c = file[position];
+            if (c == '#') {
+                while (position < file.size() && file[position] != '\n') position++;
+            }
+            else if (c == ' ' || c == '\t' || c == '\r' || c == '\n') position++;
+            else break;
+        }
+        size_t start = position;
+        while (position < file.size() && !std::isspace(static_cast<unsigned char>(file[position]))) position++;
+        word.assign(file.data() + start, position - start);
+        return !word.empty();
+    }
+
+    // Binary or ASCII PPM. Bytes are undone with the inverse of the sqrt gamma the encoders
+    // apply, so an image written by the renderer reads back as the colors it was rendered with.
+    inline bool DecodePPM(const std::vector<char>& file, size_t position, bool binary, Framebuffer& image, std::string& error) {
+        std::string word;
+        int width = 0, height = 0, maxValue = 0;
+        for (int* field : { &width, &height, &maxValue }) {
+            if (!ReadHeaderWord(file, position, word) || std::from_chars(word.data(), word.data() + word.size(), *field).ec != std::errc()) {
+                error = "bad PPM header";
+                return false;
+            }
+        }
+        if (width <= 0 || height <= 0 || maxValue <= 0 || maxValue > 65535) {
+            error = "bad PPM header";
+            return false;
+        }
+        position++; // The single whitespace character ending the header
+
+        image.Resize(width, height);
+        size_t count = image.PixelCount() * 3;
+        size_t sampleBytes = maxValue > 255 ? 2 : 1;
+        if (binary && file.size() < position + count * sampleBytes) {
+            error = "PPM data is truncated";
+            return false;
+        }
+
+        float* data = image.Data();
+        for (size_t i = 0; i < count; i++) {
+            int value;
+            if (!binary) {
+                if (!ReadHeaderWord(file, position, word) || std::from_chars(word.data(), word.data() + word.size(), value).ec != std::errc()) {
+                    error = "PPM data is truncated";
+                    return false;
+                }
+            }
+            else if (sampleBytes == 2) {
+                value = uint8_t(file[position + 2 * i]) << 8 | uint8_t(file[position + 2 * i + 1]);
+            }
+            else {
+                value = uint8_t(file[position + i]);
+            }
+            float gamma = float(value) / float(maxValue);
+            data[i] = gamma * gamma;
+        }
+        return true;
+    }
+
+    inline bool DecodePFM(const std::vector<char>& file, size_t position, Framebuffer& image, std::string& error) {
+        std::string word;
+        int width = 0, height = 0;
+        double scale = 0;
+        bool valid = ReadHeaderWord(file, position, word) && std::from_chars(word.data(), word.data() + word.size(), width).ec == std::errc()
+            && ReadHeaderWord(file, position, word) && std::from_chars(word.data(), word.data() + word.size(), height).ec == std::errc()
+            && ReadHeaderWord(file, position, word) && std::from_chars(word.data(), word.data() + word.size(), scale).ec == std::errc();
+        if (!valid || width <= 0 || height <= 0 || scale == 0) {
+            error = "bad PFM header";
+            return false;
+        }
+        position++;
+
+        image.Resize(width, height);
+        size_t rowFloats = size_t(width) * 3;
+        if (file.size() < position + rowFloats * height * sizeof(float)) {
+            error = "PFM data is truncated";
+            return false;
+        }
+
+        // A negative scale marks little-endian data; rows run bottom to top
+        bool swapBytes = (scale < 0) != (std::endian::native == std::endian::little);
+        for (int y = 0; y < height; y++) {
+            const char* row = file.data() + position + size_t(height - 1 - y) * rowFloats * sizeof(float);
+            float* target = image.Data() + size_t(y) * rowFloats;
+            for (size_t i = 0; i < rowFloats; i++) {
+                uint32_t bits;
+                std::memcpy(&bits, row + i * sizeof(float), sizeof(bits));
+                if (swapBytes) bits = (bits >> 24) | ((bits >> 8) & 0xff00u) | ((bits << 8) & 0xff0000u) | (bits << 24);
+                target[i] = std::bit_cast<float>(bits);
+            }
+        }
+        return true;
+    }
+}
+
+// Reads a P3 or P6 PPM or a color PFM into linear colors, top row first
+inline bool ReadImage(const std::string& path, Framebuffer& image, std::string& error) {
+    std::ifstream in(path, std::ios::binary);
+    if (!in) {
+        error = "could not open " + path;
+        return false;
+    }
+    std::vector<char> file((std::istreambuf_iterator<char>(in)), std::istreambuf_iterator<char>());
+
+    size_t position = 0;
+    std::string magic;
+    ImageIO::ReadHeaderWord(file, position, magic);
+    bool decoded;
+    if (magic == "P6" || magic == "P3") decoded = ImageIO::DecodePPM(file, position, magic == "P6", image, error);
+    else if (magic == "PF") decoded = ImageIO::DecodePFM(file, position, image, error);
+    else {
+        error = "not a PPM or color PFM";
+        decoded = false;
+    }
+    if (!decoded) error = path + ": " + error;
+    return decoded;
+}
+
+inline bool WriteImage(const Framebuffer& image, const std::string& path) {
+    std::vector<char> file = ImageIO::Encode(image, ImageFormatFromPath(path));
+    std::ofstream out(path, std::ios::binary);
+    out.write(file.data(), std::streamsize(file.size()));
+    return bool(out);
+}
+
+inline void WriteImage(const Framebuffer& image, std::ostream& out, ImageFormat format) {
+    std::vector<char> file = ImageIO::Encode(image, format);
+    out.write(file.data(), std::streamsize(file.size()));
+}
+
+#endif
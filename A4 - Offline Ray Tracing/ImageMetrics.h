@@ -0,0 +1,241 @@
+#ifndef IMAGE_METRICS_H
+#define IMAGE_METRICS_H
+
+#include "Framebuffer.h"
+#include "RTWeekend.h"
+
+#include <algorithm>
+#include <cmath>
+#include <vector>
+
+// Error of a render against a reference of the same size. RMSE and relMSE are over the linear
+// values of every channel; relMSE divides each squared error by the squared reference value
+// (plus 0.01, so black pixels don't dominate), weighting dark and bright regions alike.
+// FLIPError estimates how visible the difference is once both images are displayed.
+namespace ImageMetrics {
+    inline double RMSE(const Framebuffer& image, const Framebuffer& reference) {
+        const float* a = image.Data();
+        const float* b = reference.Data();
+        size_t count = reference.PixelCount() * 3;
+        double sum = 0;
+        for (size_t i = 0; i < count; i++) sum += double(a[i] - b[i]) * (a[i] - b[i]);
+        return std::sqrt(sum / double(count));
+    }
+
+    inline double RelMSE(const Framebuffer& image, const Framebuffer& reference) {
+        const float* a = image.Data();
+        const float* b = reference.Data();
+        size_t count = reference.PixelCount() * 3;
+        double sum = 0;
+        for (size_t i = 0; i < count; i++) sum += double(a[i] - b[i]) * (a[i] - b[i]) / (double(b[i]) * b[i] + 0.01);
+        return sum / double(count);
+    }
+
+    // A planar single-channel image, for the filters below
+    struct Plane {
+        int width, height;
+        std::vector<float> values;
+
+        float At(int x, int y) const {
+            return values[size_t(std::clamp(y, 0, height - 1)) * width + std::clamp(x, 0, width - 1)];
+        }
+    };
+
+    // Convolves with 'horizontal' along rows and then 'vertical' along columns, both centred
+    // kernels of odd length, clamping at the borders
+    inline Plane Separable(const Plane& plane, const std::vector<float>& horizontal, const std::vector<float>& vertical) {
+        Plane rows = { plane.width, plane.height, std::vector<float>(plane.values.size()) };
+        int radius = int(horizontal.size() / 2);
+        for (int y = 0; y < plane.height; y++) {
+            for (int x = 0; x < plane.width; x++) {
+                float sum = 0;
+                for (int k = -radius; k <= radius; k++) sum += horizontal[size_t(k + radius)] * plane.At(x + k, y);
+                rows.values[size_t(y) * plane.width + x] = sum;
+            }
+        }
+
+        Plane result = rows;
+        radius = int(vertical.size() / 2);
+        for (int y = 0; y < plane.height; y++) {
+            for (int x = 0; x < plane.width; x++) {
+                float sum = 0;
+                for (int k = -radius; k <= radius; k++) sum += vertical[size_t(k + radius)] * rows.At(x, y + k);
+                result.values[size_t(y) * plane.width + x] = sum;
+            }
+        }
+        return result;
+    }
+
+    // The displayed value of a linear one: clamped and sqrt gamma encoded like the written
+    // images, then decoded as sRGB, since that is how a monitor shows the file
+    inline double DisplayedLinear(double value) {
+        double encoded = std::sqrt(std::clamp(value, 0.0, 1.0));
+        return encoded <= 0.04045 ? encoded / 12.92 : std::pow((encoded + 0.055) / 1.055, 2.4);
+    }
+
+    // Linear sRGB and CIE XYZ under D65
+    inline Vector3 RGBToXYZ(const Vector3& c) {
+        return Vector3(0.4124564 * c.x() + 0.3575761 * c.y() + 0.1804375 * c.z(),
+            0.2126729 * c.x() + 0.7151522 * c.y() + 0.0721750 * c.z(),
+            0.0193339 * c.x() + 0.1191920 * c.y() + 0.9503041 * c.z());
+    }
+
+    inline Vector3 XYZToRGB(const Vector3& c) {
+        return Vector3(3.2404542 * c.x() - 1.5371385 * c.y() - 0.4985314 * c.z(),
+            -0.9692660 * c.x() + 1.8760108 * c.y() + 0.0415560 * c.z(),
+            0.0556434 * c.x() - 0.2040259 * c.y() + 1.0572252 * c.z());
+    }
+
+    inline const Vector3& WhitePoint() {
+        static const Vector3 white = RGBToXYZ(Vector3(1, 1, 1));
+        return white;
+    }
+
+    // Opponent space the contrast sensitivity filters work in
+    inline Vector3 XYZToYCxCz(const Vector3& c) {
+        Vector3 n(c.x() / WhitePoint().x(), c.y() / WhitePoint().y(), c.z() / WhitePoint().z());
+        return Vector3(116 * n.y() - 16, 500 * (n.x() - n.y()), 200 * (n.y() - n.z()));
+    }
+
+    inline Vector3 YCxCzToXYZ(const Vector3& c) {
+        double y = (c.x() + 16) / 116;
+        return Vector3((y + c.y() / 500) * WhitePoint().x(), y * WhitePoint().y(), (y - c.z() / 200) * WhitePoint().z());
+    }
+
+    // CIELAB with a and b scaled by 0.01 L, Hunt's observation that chroma matters less in the dark
+    inline Vector3 HuntLab(const Vector3& rgb) {
+        Vector3 xyz = RGBToXYZ(rgb);
+        auto f = [](double t) { return t > 216.0 / 24389 ? std::cbrt(t) : (24389.0 / 27 * t + 16) / 116; };
+        double fx = f(xyz.x() / WhitePoint().x()), fy = f(xyz.y() / WhitePoint().y()), fz = f(xyz.z() / WhitePoint().z());
+        double l = 116 * fy - 16;
+        return Vector3(l, 0.01 * l * 500 * (fx - fy), 0.01 * l * 200 * (fy - fz));
+    }
+
+    inline double HyAB(const Vector3& a, const Vector3& b) {
+        return std::fabs(a.x() - b.x()) + std::sqrt((a.y() - b.y()) * (a.y() - b.y()) + (a.z() - b.z()) * (a.z() - b.z()));
+    }
+
+    // Samples a sum of Gaussians a * sqrt(pi / b) * exp(-pi^2 x^2 / b), x in degrees, at pixel
+    // spacing and normalizes it to one
+    inline std::vector<float> ContrastSensitivityKernel(double a1, double b1, double a2, double b2, double pixelsPerDegree) {
+        int radius = int(std::ceil(3 * std::sqrt(std::max(b1, b2) / (2 * pi * pi)) * pixelsPerDegree));
+        std::vector<float> kernel(size_t(2 * radius + 1));
+        double sum = 0;
+        for (int i = -radius; i <= radius; i++) {
+            double x = i / pixelsPerDegree;
+            double value = a1 * std::sqrt(pi / b1) * std::exp(-pi * pi * x * x / b1) + a2 * std::sqrt(pi / b2) * std::exp(-pi * pi * x * x / b2);
+            kernel[size_t(i + radius)] = float(value);
+            sum += value;
+        }
+        for (float& value : kernel) value = float(value / sum);
+        return kernel;
+    }
+
+    // Gaussian and its first and second derivatives, for FLIP's edge and point detectors
+    struct FeatureKernels {
+        std::vector<float> gaussian, first, second;
+    };
+
+    inline FeatureKernels MakeFeatureKernels(double pixelsPerDegree) {
+        double sigma = 0.5 * 0.082 * pixelsPerDegree;
+        int radius = int(std::ceil(3 * sigma));
+        FeatureKernels kernels;
+        double gaussianSum = 0, firstPositive = 0, secondPositive = 0, secondNegative = 0;
+        for (int i = -radius; i <= radius; i++) {
+            double g = std::exp(-i * i / (2 * sigma * sigma));
+            double first = -i * g;
+            double second = (i * i / (sigma * sigma) - 1) * g;
+            kernels.gaussian.push_back(float(g));
+            kernels.first.push_back(float(first));
+            kernels.second.push_back(float(second));
+            gaussianSum += g;
+            if (first > 0) firstPositive += first;
+            (second > 0 ? secondPositive : secondNegative) += second;
+        }
+        // The derivatives are scaled so their positive and negative lobes each sum to one
+        for (size_t i = 0; i < kernels.gaussian.size(); i++) {
+            kernels.gaussian[i] = float(kernels.gaussian[i] / gaussianSum);
+            kernels.first[i] = float(kernels.first[i] / firstPositive);
+            kernels.second[i] = float(kernels.second[i] / (kernels.second[i] > 0 ? secondPositive : -secondNegative));
+        }
+        return kernels;
+    }
+
+    // Edge and point strength of a normalized luminance plane
+    inline void DetectFeatures(const Plane& luminance, const FeatureKernels& kernels, Plane& edges, Plane& points) {
+        Plane edgeX = Separable(luminance, kernels.first, kernels.gaussian);
+        Plane edgeY = Separable(luminance, kernels.gaussian, kernels.first);
+        Plane pointX = Separable(luminance, kernels.second, kernels.gaussian);
+        Plane pointY = Separable(luminance, kernels.gaussian, kernels.second);
+        edges = edgeX;
+        points = pointX;
+        for (size_t i = 0; i < edges.values.size(); i++) {
+            edges.values[i] = std::hypot(edgeX.values[i], edgeY.values[i]);
+            points.values[i] = std::hypot(pointX.values[i], pointY.values[i]);
+        }
+    }
+
+    // The display image of a render in YCxCz, filtered by the eye's contrast sensitivity, and
+    // its luminance for the feature detectors
+    inline void PrepareFLIP(const Framebuffer& image, double pixelsPerDegree, Plane filtered[3], Plane& luminance) {
+        Plane channels[3];
+        for (Plane& channel : channels) channel = { image.Width(), image.Height(), std::vector<float>(image.PixelCount()) };
+        for (int y = 0; y < image.Height(); y++) {
+            for (int x = 0; x < image.Width(); x++) {
+                Color c = image.Get(x, y);
+                Vector3 opponent = XYZToYCxCz(RGBToXYZ(Vector3(DisplayedLinear(c.x()), DisplayedLinear(c.y()), DisplayedLinear(c.z()))));
+                for (int i = 0; i < 3; i++) channels[i].values[size_t(y) * image.Width() + x] = float(opponent[i]);
+            }
+        }
+
+        // Achromatic, red-green and blue-yellow sensitivities from the FLIP paper
+        std::vector<float> achromatic = ContrastSensitivityKernel(1, 0.0047, 0, 1e-5, pixelsPerDegree);
+        std::vector<float> redGreen = ContrastSensitivityKernel(1, 0.0053, 0, 1e-5, pixelsPerDegree);
+        std::vector<float> blueYellow = ContrastSensitivityKernel(34.1, 0.04, 13.5, 0.025, pixelsPerDegree);
+        filtered[0] = Separable(channels[0], achromatic, achromatic);
+        filtered[1] = Separable(channels[1], redGreen, redGreen);
+        filtered[2] = Separable(channels[2], blueYellow, blueYellow);
+
+        luminance = channels[0];
+        for (float& value : luminance.values) value = (value + 16) / 116;
+    }
+
+    // Mean of an approximation of LDR-FLIP (Andersson et al., HPG 2020) over the displayed
+    // images, from 0 for no visible difference to 1. Follows the paper's color pipeline and
+    // feature detectors, but with Gaussians cut at 3 sigma and clamped rather than padded borders,
+    // so values are close to, not equal to, the reference implementation's. 67 pixels per degree
+    // is a 0.7 m viewing distance from a 24" 4K monitor.
+    inline double FLIPError(const Framebuffer& image, const Framebuffer& reference, double pixelsPerDegree = 67) {
+        Plane testFiltered[3], referenceFiltered[3], testLuminance, referenceLuminance;
+        PrepareFLIP(image, pixelsPerDegree, testFiltered, testLuminance);
+        PrepareFLIP(reference, pixelsPerDegree, referenceFiltered, referenceLuminance);
+
+        FeatureKernels kernels = MakeFeatureKernels(pixelsPerDegree);
+        Plane testEdges, testPoints, referenceEdges, referencePoints;
+        DetectFeatures(testLuminance, kernels, testEdges, testPoints);
+        DetectFeatures(referenceLuminance, kernels, referenceEdges, referencePoints);
+
+        // Color differences are compressed relative to the largest, green against blue
+        const double pc = 0.4, pt = 0.95;
+        double maxDifference = std::pow(HyAB(HuntLab(Vector3(0, 1, 0)), HuntLab(Vector3(0, 0, 1))), 0.7);
+
+        double sum = 0;
+        size_t count = reference.PixelCount();
+        for (size_t i = 0; i < count; i++) {
+            auto displayed = [&](const Plane filtered[3]) {
+                Vector3 rgb = XYZToRGB(YCxCzToXYZ(Vector3(filtered[0].values[i], filtered[1].values[i], filtered[2].values[i])));
+                return HuntLab(Vector3(std::clamp(rgb.x(), 0.0, 1.0), std::clamp(rgb.y(), 0.0, 1.0), std::clamp(rgb.z(), 0.0, 1.0)));
+            };
+            double color = std::pow(HyAB(displayed(testFiltered), displayed(referenceFiltered)), 0.7);
+            color = color < pc * maxDifference ? pt / (pc * maxDifference) * color
+                : pt + (color - pc * maxDifference) / (maxDifference - pc * maxDifference) * (1 - pt);
+
+            double feature = std::pow(std::max(std::fabs(testEdges.values[i] - referenceEdges.values[i]),
+                std::fabs(testPoints.values[i] - referencePoints.values[i])) / std::sqrt(2.0), 0.5);
+            sum += std::pow(color, 1 - feature);
+        }
+        return sum / double(count);
+    }
+}
+
+#endif
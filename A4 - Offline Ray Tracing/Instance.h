@@ -0,0 +1,60 @@
+#ifndef INSTANCE_H
+#define INSTANCE_H
+
+#include "Hittable.h"
+#include "Transform.h"
+
+// One placement of shared geometry, like a D3D12 instance description pointing at a BLAS. The
+// object (a TriangleMesh, or a BVH over a few objects) is referenced, never copied, so N
+// instances cost N transforms plus one copy of the geometry. A BVH or WideBVH over the
+// instances is the top level.
+//
+// Rays are moved into object space rather than the geometry into world space. The direction
+// isn't renormalized, so hit distances are the same in both spaces. Instances don't nest, and
+// emissive geometry inside one isn't registered as a light, so it is only reached by following
+// the BSDF.
+class Instance : public Hittable {
+public:
+    Instance(shared_ptr<Hittable> object, const Transform& objectToWorld)
+        : object(std::move(object)), objectToWorld(objectToWorld), bbox(objectToWorld.ApplyToBox(this->object->BoundingBox())) {
+        // Texture scales are per object-space unit; this converts them, exactly for uniform scaling
+        scale = std::cbrt(objectToWorld.ApplyToVector(Vector3(1, 0, 0)).Length()
+            * objectToWorld.ApplyToVector(Vector3(0, 1, 0)).Length() * objectToWorld.ApplyToVector(Vector3(0, 0, 1)).Length());
+    }
+
+    bool Hit(const Ray& ray, Interval rayT, HitRecord& record) const override {
+        TRACE_COUNT(hitCalls);
+        if (!object->Hit(ToObject(ray), rayT, record)) return false;
+        record.instancedObject = record.object;
+        record.object = this;
+        return true;
+    }
+
+    void ComputeSurface(const Ray& ray, HitRecord& record) const override {
+        record.instancedObject->ComputeSurface(ToObject(ray), record);
+        // The inverse transpose preserves the sign of dot(direction, normal), so frontFace holds
+        record.point = ray.At(record.t);
+        record.normal = UnitVector(objectToWorld.ApplyToNormal(record.normal));
+    }
+
+    void ComputeTextureCoordinates(const Ray& ray, HitRecord& record) const override {
+        record.instancedObject->ComputeTextureCoordinates(ToObject(ray), record);
+        record.textureScale /= scale;
+    }
+
+    AABB BoundingBox() const override { return bbox; }
+
+    const Transform& ObjectToWorld() const { return objectToWorld; }
+
+private:
+    shared_ptr<Hittable> object;
+    Transform objectToWorld;
+    AABB bbox;
+    double scale; // How much the transform stretches lengths, on average
+
+    Ray ToObject(const Ray& ray) const {
+        return Ray(objectToWorld.InverseToPoint(ray.Origin()), objectToWorld.InverseToVector(ray.Direction()));
+    }
+};
+
+#endif
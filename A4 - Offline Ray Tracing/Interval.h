@@ -3,36 +3,56 @@
 
 #include "RTWeekend.h"
 
-class Interval {
+template <typename T>
+class IntervalT {
 public:
-    double min, max;
+    T min, max;
 
-    Interval() : min(+infinity), max(-infinity) {} // Default interval is empty
+    IntervalT() : min(+Infinity()), max(-Infinity()) {} // Default interval is empty
 
-    Interval(double min, double max) : min(min), max(max) {}
+    IntervalT(T min, T max) : min(min), max(max) {}
 
-    double Size() const {
+    // Tightest interval enclosing both inputs
+    IntervalT(const IntervalT& a, const IntervalT& b) : min(a.min <= b.min ? a.min : b.min), max(a.max >= b.max ? a.max : b.max) {}
+
+    template <typename U>
+    explicit IntervalT(const IntervalT<U>& other) : min(T(other.min)), max(T(other.max)) {}
+
+    T Size() const {
         return max - min;
     }
 
-    bool Contains(double x) const {
+    bool Contains(T x) const {
         return min <= x && x <= max;
     }
 
-    bool Surrounds(double x) const {
+    bool Surrounds(T x) const {
         return min < x && x < max;
     }
 
-    double Clamp(double x) const {
+    T Clamp(T x) const {
         if (x < min) return min;
         if (x > max) return max;
         return x;
     }
 
-    static const Interval empty, universe;
+    IntervalT Expand(T delta) const {
+        T padding = delta / 2;
+        return IntervalT(min - padding, max + padding);
+    }
+
+    static const IntervalT empty, universe;
+
+private:
+    static constexpr T Infinity() { return std::numeric_limits<T>::infinity(); }
 };
 
-const Interval Interval::empty = Interval(+infinity, -infinity);
-const Interval Interval::universe = Interval(-infinity, +infinity);
+template <typename T>
+const IntervalT<T> IntervalT<T>::empty = IntervalT<T>(+Infinity(), -Infinity());
+template <typename T>
+const IntervalT<T> IntervalT<T>::universe = IntervalT<T>(-Infinity(), +Infinity());
+
+using Intervalf = IntervalT<float>;
+using Interval = IntervalT<double>;
 
 #endif
\ No newline at end of file
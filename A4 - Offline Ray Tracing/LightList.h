@@ -0,0 +1,212 @@
+#ifndef LIGHT_LIST_H
+#define LIGHT_LIST_H
+
+#include "Hittable.h"
+#include "MaterialTable.h"
+
+#include <algorithm>
+#include <cstdint>
+#include <functional>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+// A point picked on a light: the unit direction and distance to it, the radiance it sends back
+// and the solid-angle pdf of picking it, with the choice of light included
+struct LightSample {
+    Vector3 direction;
+    double distance;
+    Color radiance;
+    double pdf;
+};
+
+// The scene's emissive primitives, for next-event estimation. A light is picked in proportion
+// to its emitted power, then a sphere is sampled over the cone it subtends and a triangle
+// uniformly over its area. Pdf gives the same density for a hit found by following the BSDF,
+// so the two strategies can be weighted against each other.
+class LightList {
+public:
+    LightList() = default;
+
+    // Gathers every emissive primitive in the world through Hittable::CollectLights. Build it
+    // after the scene's materials have all been created.
+    explicit LightList(const Hittable& world) {
+        const MaterialTable& materials = MaterialTable::Global();
+        emission.resize(materials.Size());
+        for (uint32_t id = 0; id < emission.size(); id++) {
+            emission[id] = materials.Visit(id, [](const auto& material) {
+                HitRecord front;
+                front.frontFace = true;
+                return material.Emitted(front);
+            });
+        }
+
+        world.CollectLights(*this);
+
+        double totalPower = 0;
+        cdf.reserve(lights.size());
+        for (const Light& light : lights) {
+            const Color& radiance = emission[light.materialId];
+            totalPower += (0.2126 * radiance.x() + 0.7152 * radiance.y() + 0.0722 * radiance.z()) * light.area;
+            cdf.push_back(totalPower);
+        }
+        for (double& value : cdf) value /= totalPower;
+    }
+
+    bool Empty() const { return lights.empty(); }
+    size_t Size() const { return lights.size(); }
+
+    bool IsEmissive(uint32_t materialId) const {
+        if (materialId >= emission.size()) return false;
+        const Color& radiance = emission[materialId];
+        return radiance.x() > 0 || radiance.y() > 0 || radiance.z() > 0;
+    }
+
+    // Called from CollectLights; primitives with non-emissive materials are ignored
+    void AddSphere(const Point3& center, double radius, uint32_t materialId, const Hittable* object, uint32_t primitiveId) {
+        if (!IsEmissive(materialId) || radius <= 0) return;
+        Light light;
+        light.shape = Shape::Sphere;
+        light.position = center;
+        light.radius = radius;
+        light.area = 4 * pi * radius * radius;
+        light.materialId = materialId;
+        Register(light, object, primitiveId);
+    }
+
+    void AddTriangle(const Point3& p0, const Point3& p1, const Point3& p2, uint32_t materialId, const Hittable* object, uint32_t primitiveId) {
+        if (!IsEmissive(materialId)) return;
+        Vector3 normal = Cross(p1 - p0, p2 - p0);
+        double doubleArea = normal.Length();
+        if (doubleArea <= 0) return;
+
+        Light light;
+        light.shape = Shape::Triangle;
+        light.position = p0;
+        light.edge1 = p1 - p0;
+        light.edge2 = p2 - p0;
+        light.normal = normal / doubleArea;
+        light.area = 0.5 * doubleArea;
+        light.materialId = materialId;
+        Register(light, object, primitiveId);
+    }
+
+    // Picks a point on a light as seen from 'from'. Returns false when the chosen light can't
+    // contribute, e.g. its emitting side faces away.
+    bool Sample(const Point3& from, double selectU, double u, double v, LightSample& sample) const {
+        if (lights.empty()) return false;
+        size_t index = std::min(size_t(std::upper_bound(cdf.begin(), cdf.end(), selectU) - cdf.begin()), lights.size() - 1);
+        const Light& light = lights[index];
+
+        double shapePdf;
+        if (light.shape == Shape::Sphere) {
+            Vector3 toCenter = light.position - from;
+            double distanceSquared = toCenter.LengthSquared();
+            double radiusSquared = light.radius * light.radius;
+            if (distanceSquared <= radiusSquared) return false; // Inside, where only the back face is visible
+
+            double oneMinusCosMax = ConeOneMinusCos(distanceSquared, radiusSquared);
+            double cosTheta = 1 - u * oneMinusCosMax;
+            double sinTheta = std::sqrt(std::fmax(0.0, 1 - cosTheta * cosTheta));
+            double phi = 2 * pi * v;
+
+            double distance = std::sqrt(distanceSquared);
+            Vector3 axis = toCenter / distance, tangent, bitangent;
+            Basis(axis, tangent, bitangent);
+            sample.direction = sinTheta * std::cos(phi) * tangent + sinTheta * std::sin(phi) * bitangent + cosTheta * axis;
+            sample.distance = distance * cosTheta - std::sqrt(std::fmax(0.0, radiusSquared - distanceSquared * sinTheta * sinTheta));
+            shapePdf = 1 / (2 * pi * oneMinusCosMax);
+        }
+        else {
+            double root = std::sqrt(u);
+            Point3 point = light.position + root * (1 - v) * light.edge1 + root * v * light.edge2;
+            Vector3 toPoint = point - from;
+            double distanceSquared = toPoint.LengthSquared();
+            sample.distance = std::sqrt(distanceSquared);
+            sample.direction = toPoint / sample.distance;
+
+            double cosine = -Dot(sample.direction, light.normal);
+            if (cosine <= 0) return false;
+            shapePdf = distanceSquared / (light.area * cosine);
+        }
+
+        sample.radiance = emission[light.materialId];
+        sample.pdf = Probability(index) * shapePdf;
+        return sample.pdf > 0 && sample.distance > 0;
+    }
+
+    // The density Sample would have given the point 'record' describes, reached by 'ray' from
+    // its origin. Zero for surfaces that aren't in the list.
+    double Pdf(const Ray& ray, const HitRecord& record) const {
+        auto found = lookup.find({ record.object, record.primitiveId });
+        if (found == lookup.end()) return 0;
+        const Light& light = lights[found->second];
+
+        if (light.shape == Shape::Sphere) {
+            double distanceSquared = (light.position - ray.Origin()).LengthSquared();
+            double radiusSquared = light.radius * light.radius;
+            if (distanceSquared <= radiusSquared) return 0;
+            return Probability(found->second) / (2 * pi * ConeOneMinusCos(distanceSquared, radiusSquared));
+        }
+
+        Vector3 toPoint = record.point - ray.Origin();
+        double cosine = std::fabs(Dot(UnitVector(toPoint), light.normal));
+        if (cosine <= 0) return 0;
+        return Probability(found->second) * toPoint.LengthSquared() / (light.area * cosine);
+    }
+
+private:
+    enum class Shape {
+        Sphere,
+        Triangle,
+    };
+
+    struct Light {
+        Shape shape;
+        Point3 position;        // Sphere center or first triangle corner
+        Vector3 edge1, edge2;   // Triangle edges from the first corner
+        Vector3 normal;         // Triangle front-face normal
+        double radius = 0;
+        double area = 0;
+        uint32_t materialId = 0;
+    };
+
+    using LightKey = std::pair<const Hittable*, uint32_t>;
+
+    struct LightKeyHash {
+        size_t operator()(const LightKey& key) const {
+            return std::hash<const void*>()(key.first) ^ (size_t(key.second) * 0x9e3779b97f4a7c15ull);
+        }
+    };
+
+    std::vector<Light> lights;
+    std::vector<double> cdf;
+    std::vector<Color> emission; // Front-face radiance of every material, by id
+    std::unordered_map<LightKey, uint32_t, LightKeyHash> lookup;
+
+    void Register(const Light& light, const Hittable* object, uint32_t primitiveId) {
+        lookup.emplace(LightKey(object, primitiveId), uint32_t(lights.size()));
+        lights.push_back(light);
+    }
+
+    double Probability(size_t index) const {
+        return cdf[index] - (index > 0 ? cdf[index - 1] : 0);
+    }
+
+    // 1 - cos of the cone's half-angle, in a form that stays accurate for small, far lights
+    static double ConeOneMinusCos(double distanceSquared, double radiusSquared) {
+        double sinSquared = radiusSquared / distanceSquared;
+        return sinSquared / (1 + std::sqrt(std::fmax(0.0, 1 - sinSquared)));
+    }
+
+    // Two unit vectors completing 'axis' to an orthonormal basis (Duff et al., JCGT 2017)
+    static void Basis(const Vector3& axis, Vector3& tangent, Vector3& bitangent) {
+        double sign = std::copysign(1.0, axis.z());
+        double a = -1 / (sign + axis.z());
+        double b = axis.x() * axis.y() * a;
+        tangent = Vector3(1 + sign * axis.x() * axis.x() * a, sign * b, -sign * axis.x());
+        bitangent = Vector3(b, sign + axis.y() * axis.y() * a, -axis.y());
+    }
+};
+
+#endif
@@ -2,55 +2,109 @@
 #define MATERIAL_H
 
 #include "Hittable.h"
+#include "Sampler.h"
+#include "Texture.h"
 
 class Material {
 public:
     virtual ~Material() = default;
 
-    virtual bool Scatter(const Ray& rayIn, const HitRecord& record, Color& attenuation, Ray& scattered) const {
+    virtual bool Scatter(const Ray& rayIn, const HitRecord& record, Color& attenuation, Ray& scattered, PathSampler& sampler) const {
+        return false;
+    }
+
+    // Radiance leaving the surface toward the ray that produced 'record'
+    virtual Color Emitted(const HitRecord& record) const {
+        return Color(0, 0, 0);
+    }
+
+    // The scattering toward 'direction' (BSDF times cosine) and the pdf Scatter picks it with.
+    // Materials that can't be evaluated for an arbitrary direction, such as mirrors and glass,
+    // return false; only the others sample lights directly.
+    virtual bool Evaluate(const HitRecord& record, const Vector3& direction, Color& value, double& pdf) const {
+        return false;
+    }
+
+    // The surface color the denoiser's albedo image shows
+    virtual Color Albedo(const HitRecord& record) const {
+        return Color(1, 1, 1);
+    }
+
+    // Whether the record's texture coordinates and footprint need filling in before the calls above
+    virtual bool UsesTexture() const {
         return false;
     }
 };
 
-class Lambertian : public Material {
+class Lambertian final : public Material {
 public:
     Lambertian(const Color& albedo) : albedo(albedo) {}
+    // The texture's color times 'tint'
+    Lambertian(shared_ptr<ImageTexture> texture, const Color& tint = Color(1, 1, 1)) : albedo(tint), texture(std::move(texture)) {}
 
-    bool Scatter (const Ray& rayIn, const HitRecord& record, Color& attenuation, Ray& scattered) const override {
-        Vector3 scatterDirection = record.normal + RandomUnitVector();
+    bool Scatter (const Ray& rayIn, const HitRecord& record, Color& attenuation, Ray& scattered, PathSampler& sampler) const override {
+        Vector3 scatterDirection = record.normal + RandomUnitVector(sampler);
         if (scatterDirection.NearZero()) scatterDirection = record.normal;
 
         scattered = Ray(record.point, scatterDirection);
-        attenuation = albedo;
+        attenuation = AlbedoAt(record);
+        return true;
+    }
+
+    bool Evaluate(const HitRecord& record, const Vector3& direction, Color& value, double& pdf) const override {
+        // Scatter's normal-plus-unit-vector direction is cosine distributed
+        double cosine = std::fmax(0.0, Dot(record.normal, UnitVector(direction)));
+        pdf = cosine / pi;
+        value = AlbedoAt(record) * pdf;
         return true;
     }
 
+    Color Albedo(const HitRecord& record) const override { return AlbedoAt(record); }
+    bool UsesTexture() const override { return texture != nullptr; }
+
 private:
     Color albedo;
+    shared_ptr<ImageTexture> texture;
+
+    Color AlbedoAt(const HitRecord& record) const {
+        if (!texture) return albedo;
+        return albedo * texture->Value(record.textureU, record.textureV, record.footprint * record.textureScale);
+    }
 };
 
-class Metal : public Material {
+class Metal final : public Material {
 public:
     Metal(const Color& albedo, double fuzz) : albedo(albedo), fuzz(fuzz < 1 ? fuzz : 1) {}
+    Metal(shared_ptr<ImageTexture> texture, double fuzz, const Color& tint = Color(1, 1, 1))
+        : albedo(tint), fuzz(fuzz < 1 ? fuzz : 1), texture(std::move(texture)) {}
 
-    bool Scatter (const Ray& rayIn, const HitRecord& record, Color& attenuation, Ray& scattered) const override {
+    bool Scatter (const Ray& rayIn, const HitRecord& record, Color& attenuation, Ray& scattered, PathSampler& sampler) const override {
         Vector3 reflected = Reflect(rayIn.Direction(), record.normal);
-        reflected = UnitVector(reflected) + fuzz * RandomUnitVector();
+        reflected = UnitVector(reflected) + fuzz * RandomUnitVector(sampler);
         scattered = Ray(record.point, reflected);
-        attenuation = albedo;
+        attenuation = AlbedoAt(record);
         return Dot(scattered.Direction(), record.normal) > 0;
     }
 
+    Color Albedo(const HitRecord& record) const override { return AlbedoAt(record); }
+    bool UsesTexture() const override { return texture != nullptr; }
+
 private:
     Color albedo;
     double fuzz;
+    shared_ptr<ImageTexture> texture;
+
+    Color AlbedoAt(const HitRecord& record) const {
+        if (!texture) return albedo;
+        return albedo * texture->Value(record.textureU, record.textureV, record.footprint * record.textureScale);
+    }
 };
 
-class Dielectric : public Material {
+class Dielectric final : public Material {
 public:
     Dielectric(double refractionIndex) : refractionIndex(refractionIndex) {}
 
-    bool Scatter(const Ray& rayIn, const HitRecord& record, Color& attenuation, Ray& scattered) const override {
+    bool Scatter(const Ray& rayIn, const HitRecord& record, Color& attenuation, Ray& scattered, PathSampler& sampler) const override {
         attenuation = Color(1, 1, 1);
         double localRI = record.frontFace ? 1 / refractionIndex : refractionIndex;
 
@@ -59,7 +113,7 @@ public:
         double sinTheta = sqrt(1 - cosTheta * cosTheta);
         
         bool cannotRefract = localRI * sinTheta > 1;
-        Vector3 direction = cannotRefract || Reflectance(cosTheta, localRI) > RandomDouble() ?
+        Vector3 direction = cannotRefract || Reflectance(cosTheta, localRI) > RandomDouble(sampler) ?
             Reflect(unitDirection, record.normal) :
             Refract(unitDirection, record.normal, localRI);
 
@@ -77,4 +131,17 @@ private:
     }
 };
 
+// Emits from its front face only and scatters nothing
+class DiffuseLight final : public Material {
+public:
+    DiffuseLight(const Color& emit) : emit(emit) {}
+
+    Color Emitted(const HitRecord& record) const override {
+        return record.frontFace ? emit : Color(0, 0, 0);
+    }
+
+private:
+    Color emit;
+};
+
 #endif
\ No newline at end of file
@@ -0,0 +1,78 @@
+#ifndef MATERIAL_TABLE_H
+#define MATERIAL_TABLE_H
+
+#include "Material.h"
+
+#include <cstdint>
+#include <unordered_map>
+#include <variant>
+#include <vector>
+
+// Every material a scene uses, addressed by a 32-bit id. Primitives store ids instead of
+// shared_ptrs, so tracing never touches a reference count. Materials are registered while the
+// scene is built and the table is only read while rendering.
+//
+// Alongside the pointers the table keeps a closed-world copy: built-in materials by value in a
+// variant, so Visit can switch on the tag instead of making a virtual call. Other Material
+// subclasses are reached through their pointer either way.
+class MaterialTable {
+public:
+    static MaterialTable& Global() {
+        static MaterialTable table;
+        return table;
+    }
+
+    // Returns the existing id if this material was already added
+    uint32_t Add(const shared_ptr<Material>& material) {
+        auto found = lookup.find(material.get());
+        if (found != lookup.end()) return found->second;
+
+        uint32_t id = uint32_t(materials.size());
+        materials.push_back(material);
+        lookup.emplace(material.get(), id);
+        textured.push_back(material->UsesTexture());
+
+        if (auto lambertian = dynamic_cast<const Lambertian*>(material.get()))
+            records.push_back(*lambertian);
+        else if (auto metal = dynamic_cast<const Metal*>(material.get()))
+            records.push_back(*metal);
+        else if (auto dielectric = dynamic_cast<const Dielectric*>(material.get()))
+            records.push_back(*dielectric);
+        else if (auto light = dynamic_cast<const DiffuseLight*>(material.get()))
+            records.push_back(*light);
+        else
+            records.push_back(material.get());
+        return id;
+    }
+
+    const Material& operator[](uint32_t id) const { return *materials[id]; }
+
+    // Calls 'function' with the material as its concrete type when it is a built-in one, so
+    // a generic lambda's calls on it are direct, and as a Material otherwise
+    template <typename Function>
+    decltype(auto) Visit(uint32_t id, Function&& function) const {
+        const MaterialRecord& material = records[id];
+        switch (material.index()) {
+        case 0: return function(*std::get_if<Lambertian>(&material));
+        case 1: return function(*std::get_if<Metal>(&material));
+        case 2: return function(*std::get_if<Dielectric>(&material));
+        case 3: return function(*std::get_if<DiffuseLight>(&material));
+        default: return function(**std::get_if<const Material*>(&material));
+        }
+    }
+
+    size_t Size() const { return materials.size(); }
+
+    bool UsesTexture(uint32_t id) const { return textured[id]; }
+
+private:
+    // The built-in materials are final, so calls on the stored values are direct
+    using MaterialRecord = std::variant<Lambertian, Metal, Dielectric, DiffuseLight, const Material*>;
+
+    std::vector<shared_ptr<Material>> materials;
+    std::vector<MaterialRecord> records;
+    std::vector<char> textured;
+    std::unordered_map<const Material*, uint32_t> lookup;
+};
+
+#endif
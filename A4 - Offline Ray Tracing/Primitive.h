@@ -0,0 +1,64 @@
+#ifndef PRIMITIVE_H
+#define PRIMITIVE_H
+
+#include "Hittable.h"
+#include "Sphere.h"
+
+#include <variant>
+
+// One acceleration-structure leaf entry. In closed-world mode the geometry of the built-in
+// primitive types is copied in by value, so leaves are contiguous and Hit is a switch the
+// compiler can inline; anything else (and everything, in Virtual mode) is kept as a pointer and
+// called virtually.
+class Primitive {
+public:
+    Primitive(const shared_ptr<Hittable>& object, Dispatch dispatch) : shape(MakeShape(object, dispatch)) {}
+
+    bool Hit(const Ray& ray, Interval rayT, HitRecord& record) const {
+        switch (shape.index()) {
+        case 0: {
+            const SphereShape& sphere = *std::get_if<SphereShape>(&shape);
+            if (!Sphere::Intersect(sphere.center, sphere.radius, ray, rayT, record.t)) return false;
+            record.object = sphere.source.get(); // Still computes the surface for the closest hit
+            record.primitiveId = 0;
+            return true;
+        }
+        default: return (*std::get_if<shared_ptr<Hittable>>(&shape))->Hit(ray, rayT, record);
+        }
+    }
+
+    void CollectLights(LightList& lights) const {
+        switch (shape.index()) {
+        case 0: std::get_if<SphereShape>(&shape)->source->CollectLights(lights); break;
+        default: (*std::get_if<shared_ptr<Hittable>>(&shape))->CollectLights(lights); break;
+        }
+    }
+
+    AABB BoundingBox() const {
+        switch (shape.index()) {
+        case 0: return std::get_if<SphereShape>(&shape)->source->BoundingBox();
+        default: return (*std::get_if<shared_ptr<Hittable>>(&shape))->BoundingBox();
+        }
+    }
+
+private:
+    struct SphereShape {
+        Point3 center;
+        double radius;
+        shared_ptr<const Sphere> source; // Only used off the hot path, for the surface and lights
+    };
+
+    using Shape = std::variant<SphereShape, shared_ptr<Hittable>>;
+
+    static Shape MakeShape(const shared_ptr<Hittable>& object, Dispatch dispatch) {
+        if (dispatch == Dispatch::ClosedWorld) {
+            if (auto sphere = std::dynamic_pointer_cast<const Sphere>(object))
+                return SphereShape{ sphere->Center(), sphere->Radius(), std::move(sphere) };
+        }
+        return object;
+    }
+
+    Shape shape;
+};
+
+#endif
@@ -2,6 +2,7 @@
 #define RTWEEKEND_H
 
 #include <cmath>
+#include <cstdint>
 #include <cstdlib>
 #include <iostream>
 #include <limits>
@@ -24,12 +25,52 @@ inline double DegreesToRadians(double degrees) {
     return degrees * pi / 180.0;
 }
 
-inline double RandomDouble() {
-    return std::rand() / (RAND_MAX + 1.0);
+// PCG32 generator. Every path gets its own generator keyed by pixel, sample and bounce,
+// so the numbers a path sees never depend on which thread traced it or in what order.
+class Rng {
+public:
+    Rng(uint64_t seed, uint64_t stream) : state(0), increment((stream << 1u) | 1u) {
+        NextUInt();
+        state += seed;
+        NextUInt();
+    }
+
+    static Rng ForPath(uint32_t pixel, uint32_t sample, uint32_t bounce, uint64_t seed = 0) {
+        return Rng(Mix((uint64_t(pixel) << 32 | sample) ^ seed), bounce);
+    }
+
+    uint32_t NextUInt() {
+        uint64_t old = state;
+        state = old * 6364136223846793005ull + increment;
+        uint32_t xorShifted = uint32_t(((old >> 18u) ^ old) >> 27u);
+        uint32_t rotation = uint32_t(old >> 59u);
+        return (xorShifted >> rotation) | (xorShifted << ((0u - rotation) & 31u));
+    }
+
+    // Uniform in [0, 1)
+    double NextDouble() {
+        return NextUInt() * (1.0 / 4294967296.0);
+    }
+
+    // SplitMix64 finalizer, spreads neighbouring pixel/sample keys across the whole seed space
+    static uint64_t Mix(uint64_t x) {
+        x += 0x9e3779b97f4a7c15ull;
+        x = (x ^ (x >> 30)) * 0xbf58476d1ce4e5b9ull;
+        x = (x ^ (x >> 27)) * 0x94d049bb133111ebull;
+        return x ^ (x >> 31);
+    }
+
+private:
+    uint64_t state;
+    uint64_t increment;
+};
+
+inline double RandomDouble(Rng& rng) {
+    return rng.NextDouble();
 }
 
-inline double RandomDouble(double min, double max) {
-    return min + (max - min) * RandomDouble();
+inline double RandomDouble(Rng& rng, double min, double max) {
+    return min + (max - min) * RandomDouble(rng);
 }
 
 // Common Headers
@@ -3,22 +3,29 @@
 
 #include "Vector3.h"
 
-class Ray {
+template <typename T>
+class RayT {
 public:
-    Ray() {}
+    RayT() {}
 
-    Ray(const Point3& origin, const Vector3& direction) : origin(origin), direction(direction) {}
+    RayT(const Vector3T<T>& origin, const Vector3T<T>& direction) : origin(origin), direction(direction) {}
 
-    const Point3& Origin() const { return origin; }
-    const Vector3& Direction() const { return direction; }
+    template <typename U>
+    explicit RayT(const RayT<U>& other) : origin(other.Origin()), direction(other.Direction()) {}
 
-    Point3 At(double magnitude) const {
+    const Vector3T<T>& Origin() const { return origin; }
+    const Vector3T<T>& Direction() const { return direction; }
+
+    Vector3T<T> At(T magnitude) const {
         return origin + magnitude * direction;
     }
 
 private:
-    Point3 origin;
-    Vector3 direction;
+    Vector3T<T> origin;
+    Vector3T<T> direction;
 };
 
+using Rayf = RayT<float>;
+using Ray = RayT<double>;
+
 #endif
\ No newline at end of file
@@ -0,0 +1,392 @@
+#ifndef SAMPLER_H
+#define SAMPLER_H
+
+#include "RTWeekend.h"
+
+#include <array>
+#include <cmath>
+#include <cstdint>
+#include <memory>
+#include <vector>
+
+enum class SamplerType {
+    Independent, // Uniform random numbers for every dimension
+    Stratified,  // Jittered strata over each pixel's samplesPerPixel, shuffled per dimension
+    Sobol,       // Owen-scrambled Sobol points, shuffled per pixel
+    BlueNoise,   // One Sobol sequence shared by every pixel, offset per pixel by a blue-noise mask
+};
+
+// Hands out the components of each pixel's sample points. A sample is a point in a
+// high-dimensional unit cube: the camera takes the first dimensions for the pixel and lens
+// positions and every bounce gets its own block after those. Each component is a pure function
+// of pixel, sample index, dimension and seed, so the value never depends on evaluation order.
+class Sampler {
+public:
+    virtual ~Sampler() = default;
+
+    // In [0, 1)
+    virtual double Get1D(uint32_t pixel, uint32_t sample, uint32_t dimension) const = 0;
+
+    // Dimensions 'dimension' and 'dimension + 1', distributed well as a pair
+    virtual void Get2D(uint32_t pixel, uint32_t sample, uint32_t dimension, double& u, double& v) const {
+        u = Get1D(pixel, sample, dimension);
+        v = Get1D(pixel, sample, dimension + 1);
+    }
+
+    // 'samplesPerPixel' sizes the strata of the stratified sampler; 'imageWidth' turns pixel
+    // indices back into the coordinates the blue-noise mask is tiled over
+    static std::unique_ptr<Sampler> Create(SamplerType type, uint64_t seed, uint32_t samplesPerPixel, int imageWidth);
+
+protected:
+    static uint32_t Hash(uint64_t a, uint64_t b, uint64_t c = 0) {
+        return uint32_t(Rng::Mix(Rng::Mix(a ^ b) ^ c) >> 32);
+    }
+
+    static double ToUnit(uint32_t bits) {
+        return bits * (1.0 / 4294967296.0);
+    }
+
+    static uint32_t ReverseBits(uint32_t x) {
+        x = (x << 16) | (x >> 16);
+        x = ((x & 0x00ff00ffu) << 8) | ((x & 0xff00ff00u) >> 8);
+        x = ((x & 0x0f0f0f0fu) << 4) | ((x & 0xf0f0f0f0u) >> 4);
+        x = ((x & 0x33333333u) << 2) | ((x & 0xccccccccu) >> 2);
+        x = ((x & 0x55555555u) << 1) | ((x & 0xaaaaaaaau) >> 1);
+        return x;
+    }
+
+    // The first two Sobol dimensions, as 32-bit fractions. The first is the van der Corput
+    // sequence; the second's direction numbers come from the polynomial x + 1.
+    static uint32_t Sobol0(uint32_t index) {
+        return ReverseBits(index);
+    }
+
+    // Scrambled indices use all 32 bits, so the XOR of direction numbers is looked up a byte
+    // at a time rather than a bit at a time
+    static uint32_t Sobol1(uint32_t index) {
+        static const std::array<uint32_t, 4 * 256> table = [] {
+            std::array<uint32_t, 4 * 256> entries = {};
+            uint32_t directions[32];
+            directions[0] = 1u << 31;
+            for (int bit = 1; bit < 32; bit++)
+                directions[bit] = directions[bit - 1] ^ (directions[bit - 1] >> 1);
+            for (int byte = 0; byte < 4; byte++) {
+                for (uint32_t value = 0; value < 256; value++) {
+                    for (int bit = 0; bit < 8; bit++) {
+                        if (value & (1u << bit)) entries[byte * 256 + value] ^= directions[byte * 8 + bit];
+                    }
+                }
+            }
+            return entries;
+        }();
+        return table[index & 0xff] ^ table[256 + ((index >> 8) & 0xff)] ^
+            table[512 + ((index >> 16) & 0xff)] ^ table[768 + (index >> 24)];
+    }
+
+    // Hash-based nested uniform (Owen) scrambling of a 32-bit fraction, after Burley,
+    // "Practical Hash-based Owen Scrambling" (JCGT 2020). Applied to a sample index it is a
+    // shuffle that keeps every power-of-two prefix of the sequence well stratified.
+    static uint32_t OwenScramble(uint32_t x, uint32_t seed) {
+        x = ReverseBits(x);
+        x += seed;
+        x ^= x * 0x6c50b47cu;
+        x ^= x * 0xb82f1e52u;
+        x ^= x * 0xc7afe638u;
+        x ^= x * 0x8d22f6e6u;
+        return ReverseBits(x);
+    }
+};
+
+class IndependentSampler final : public Sampler {
+public:
+    IndependentSampler(uint64_t seed) : seed(seed) {}
+
+    double Get1D(uint32_t pixel, uint32_t sample, uint32_t dimension) const override {
+        return ToUnit(Hash(uint64_t(pixel) << 32 | sample, seed, dimension));
+    }
+
+private:
+    uint64_t seed;
+};
+
+// Splits each dimension into samplesPerPixel strata (pairs into a square grid) and gives every
+// sample its own stratum, in an order shuffled per pixel and dimension. Samples past the last
+// stratum start a new, independently shuffled round.
+class StratifiedSampler final : public Sampler {
+public:
+    StratifiedSampler(uint64_t seed, uint32_t samplesPerPixel)
+        : seed(seed), strata(samplesPerPixel > 0 ? samplesPerPixel : 1), gridSize(uint32_t(std::sqrt(double(strata)))) {}
+
+    double Get1D(uint32_t pixel, uint32_t sample, uint32_t dimension) const override {
+        uint32_t stratum = Permute(sample % strata, strata, Hash(pixel, seed ^ (sample / strata), dimension));
+        double jitter = ToUnit(Hash(uint64_t(pixel) << 32 | sample, ~seed, dimension));
+        return (stratum + jitter) / strata;
+    }
+
+    void Get2D(uint32_t pixel, uint32_t sample, uint32_t dimension, double& u, double& v) const override {
+        uint32_t cells = gridSize * gridSize;
+        uint32_t cell = Permute(sample % cells, cells, Hash(pixel, seed ^ (sample / cells), dimension));
+        u = (cell % gridSize + ToUnit(Hash(uint64_t(pixel) << 32 | sample, ~seed, dimension))) / gridSize;
+        v = (cell / gridSize + ToUnit(Hash(uint64_t(pixel) << 32 | sample, ~seed, dimension + 1))) / gridSize;
+    }
+
+private:
+    uint64_t seed;
+    uint32_t strata;
+    uint32_t gridSize;
+
+    // A pseudo-random permutation of [0, length) picked by 'key', from Kensler,
+    // "Correlated Multi-Jittered Sampling" (2013)
+    static uint32_t Permute(uint32_t i, uint32_t length, uint32_t key) {
+        uint32_t mask = length - 1;
+        mask |= mask >> 1;
+        mask |= mask >> 2;
+        mask |= mask >> 4;
+        mask |= mask >> 8;
+        mask |= mask >> 16;
+        do {
+            i ^= key;
+            i *= 0xe170893du;
+            i ^= key >> 16;
+            i ^= (i & mask) >> 4;
+            i ^= key >> 8;
+            i *= 0x0929eb3fu;
+            i ^= key >> 23;
+            i ^= (i & mask) >> 1;
+            i *= 1 | key >> 27;
+            i *= 0x6935fa69u;
+            i ^= (i & mask) >> 11;
+            i *= 0x74dcb303u;
+            i ^= (i & mask) >> 2;
+            i *= 0x9e501cc3u;
+            i ^= (i & mask) >> 2;
+            i *= 0xc860a3dfu;
+            i &= mask;
+            i ^= i >> 5;
+        } while (i >= length);
+        return (i + key) % length;
+    }
+};
+
+// Every dimension pair is its own 2D Sobol sequence with independent Owen scrambling, and the
+// sample index is shuffled per pixel and pair, which decorrelates the pairs from each other
+// (Burley's padding scheme). Any prefix of a pixel's samples stays well stratified, so this
+// suits progressive and adaptive rendering.
+class SobolSampler final : public Sampler {
+public:
+    SobolSampler(uint64_t seed) : seed(seed) {}
+
+    double Get1D(uint32_t pixel, uint32_t sample, uint32_t dimension) const override {
+        uint32_t key = Hash(pixel, seed, dimension);
+        uint32_t index = OwenScramble(sample, key);
+        return ToUnit(OwenScramble(Sobol0(index), key ^ 0x5bd1e995u));
+    }
+
+    void Get2D(uint32_t pixel, uint32_t sample, uint32_t dimension, double& u, double& v) const override {
+        uint32_t key = Hash(pixel, seed, dimension);
+        uint32_t index = OwenScramble(sample, key);
+        u = ToUnit(OwenScramble(Sobol0(index), key ^ 0x5bd1e995u));
+        v = ToUnit(OwenScramble(Sobol1(index), key ^ 0x68e31da4u));
+    }
+
+private:
+    uint64_t seed;
+};
+
+// Blue-noise dithered sampling (Georgiev and Fajardo 2016): every pixel uses the same
+// scrambled Sobol points, toroidally shifted by a value from a tiled blue-noise mask. The
+// per-pixel error then has a blue-noise spectrum, which reads as much finer noise at low
+// sample counts. As with SobolSampler the sample index is shuffled per dimension pair, but
+// not per pixel, so every pixel still shares one point set; each dimension looks the mask up
+// at its own offset.
+class BlueNoiseSampler final : public Sampler {
+public:
+    BlueNoiseSampler(uint64_t seed, int imageWidth) : seed(seed), imageWidth(uint32_t(imageWidth > 0 ? imageWidth : 1)) {}
+
+    double Get1D(uint32_t pixel, uint32_t sample, uint32_t dimension) const override {
+        uint32_t key = Hash(seed, dimension, 1);
+        uint32_t index = OwenScramble(sample, key);
+        return Shift(ToUnit(OwenScramble(Sobol0(index), key ^ 0x5bd1e995u)), pixel, dimension);
+    }
+
+    void Get2D(uint32_t pixel, uint32_t sample, uint32_t dimension, double& u, double& v) const override {
+        uint32_t key = Hash(seed, dimension, 2);
+        uint32_t index = OwenScramble(sample, key);
+        u = Shift(ToUnit(OwenScramble(Sobol0(index), key ^ 0x5bd1e995u)), pixel, dimension);
+        v = Shift(ToUnit(OwenScramble(Sobol1(index), key ^ 0x68e31da4u)), pixel, dimension + 1);
+    }
+
+private:
+    static constexpr int maskSize = 64;
+
+    uint64_t seed;
+    uint32_t imageWidth;
+
+    double Shift(double value, uint32_t pixel, uint32_t dimension) const {
+        uint32_t offset = Hash(seed, dimension, 3);
+        uint32_t x = (pixel % imageWidth + offset) % maskSize;
+        uint32_t y = (pixel / imageWidth + (offset >> 8)) % maskSize;
+        double shifted = value + (Mask()[y * maskSize + x] + 0.5) / (maskSize * maskSize);
+        return shifted < 1 ? shifted : shifted - 1;
+    }
+
+    // Ranks 0..4095 arranged by Ulichney's void-and-cluster method, built once on first use
+    static const std::vector<uint16_t>& Mask() {
+        static const std::vector<uint16_t> mask = BuildMask();
+        return mask;
+    }
+
+    static std::vector<uint16_t> BuildMask() {
+        constexpr int count = maskSize * maskSize;
+
+        // Toroidal Gaussian, indexed by the wrapped offset between two texels
+        std::vector<float> kernel(count);
+        for (int dy = 0; dy < maskSize; dy++) {
+            for (int dx = 0; dx < maskSize; dx++) {
+                int x = dx < maskSize / 2 ? dx : maskSize - dx;
+                int y = dy < maskSize / 2 ? dy : maskSize - dy;
+                kernel[dy * maskSize + dx] = float(std::exp(-(x * x + y * y) / (2 * 1.9 * 1.9)));
+            }
+        }
+
+        std::vector<char> points(count, 0);
+        std::vector<float> energy(count, 0.0f);
+        auto toggle = [&](int texel) {
+            float sign = points[texel] ? -1.0f : 1.0f;
+            points[texel] ^= 1;
+            int tx = texel % maskSize, ty = texel / maskSize;
+            for (int y = 0; y < maskSize; y++) {
+                const float* row = &kernel[((y - ty) & (maskSize - 1)) * maskSize];
+                for (int x = 0; x < maskSize; x++)
+                    energy[y * maskSize + x] += sign * row[(x - tx) & (maskSize - 1)];
+            }
+        };
+        // Tightest cluster: the point with the most energy. Largest void: the gap with the least.
+        auto find = [&](char isPoint, bool highest) {
+            int best = -1;
+            for (int texel = 0; texel < count; texel++) {
+                if (points[texel] != isPoint) continue;
+                if (best < 0 || (highest ? energy[texel] > energy[best] : energy[texel] < energy[best])) best = texel;
+            }
+            return best;
+        };
+
+        // Random initial pattern, relaxed until moving the tightest cluster doesn't help
+        Rng rng(0x626c7565ull, 0);
+        int initialPoints = count / 10;
+        for (int placed = 0; placed < initialPoints;) {
+            int texel = int(rng.NextUInt() % count);
+            if (!points[texel]) {
+                toggle(texel);
+                placed++;
+            }
+        }
+        for (int step = 0; step < count; step++) {
+            int cluster = find(1, true);
+            toggle(cluster);
+            int gap = find(0, false);
+            toggle(gap);
+            if (gap == cluster) break;
+        }
+
+        std::vector<uint16_t> ranks(count);
+        std::vector<char> initialPattern = points;
+        std::vector<float> initialEnergy = energy;
+
+        // Rank the initial points by removing the tightest cluster each time
+        for (int rank = initialPoints - 1; rank >= 0; rank--) {
+            int cluster = find(1, true);
+            toggle(cluster);
+            ranks[cluster] = uint16_t(rank);
+        }
+
+        // Then the rest by filling the largest void each time
+        points = initialPattern;
+        energy = initialEnergy;
+        for (int rank = initialPoints; rank < count; rank++) {
+            int gap = find(0, false);
+            toggle(gap);
+            ranks[gap] = uint16_t(rank);
+        }
+        return ranks;
+    }
+};
+
+inline std::unique_ptr<Sampler> Sampler::Create(SamplerType type, uint64_t seed, uint32_t samplesPerPixel, int imageWidth) {
+    switch (type) {
+    case SamplerType::Stratified: return std::make_unique<StratifiedSampler>(seed, samplesPerPixel);
+    case SamplerType::Sobol: return std::make_unique<SobolSampler>(seed);
+    case SamplerType::BlueNoise: return std::make_unique<BlueNoiseSampler>(seed, imageWidth);
+    default: return std::make_unique<IndependentSampler>(seed);
+    }
+}
+
+// Draws the dimensions of one block of a path's sample in order. Draws past the block fall
+// back to the path's own random stream, so a material that needs more numbers than its block
+// holds still gets independent ones.
+class PathSampler {
+public:
+    PathSampler(const Sampler& sampler, uint32_t pixel, uint32_t sample, uint32_t firstDimension, uint32_t dimensionCount, const Rng& fallback)
+        : sampler(sampler), pixel(pixel), sample(sample), next(firstDimension), end(firstDimension + dimensionCount), fallback(fallback) {}
+
+    double Next1D() {
+        if (next + 1 > end) return fallback.NextDouble();
+        return sampler.Get1D(pixel, sample, next++);
+    }
+
+    void Next2D(double& u, double& v) {
+        if (next + 2 > end) {
+            u = fallback.NextDouble();
+            v = fallback.NextDouble();
+            return;
+        }
+        sampler.Get2D(pixel, sample, next, u, v);
+        next += 2;
+    }
+
+private:
+    const Sampler& sampler;
+    uint32_t pixel;
+    uint32_t sample;
+    uint32_t next;
+    uint32_t end;
+    Rng fallback;
+};
+
+inline double RandomDouble(PathSampler& sampler) {
+    return sampler.Next1D();
+}
+
+// The rejection samplers in Vector3.h use a varying amount of numbers, which would break
+// stratification, so these map exactly one 2D sample each
+
+inline Vector3 RandomUnitVector(PathSampler& sampler) {
+    double u, v;
+    sampler.Next2D(u, v);
+    double z = 1 - 2 * u;
+    double r = std::sqrt(std::fmax(0.0, 1 - z * z));
+    double phi = 2 * pi * v;
+    return Vector3(r * std::cos(phi), r * std::sin(phi), z);
+}
+
+// Shirley and Chiu's concentric mapping, which keeps neighbouring samples neighbours on the disk
+inline Vector3 RandomInUnitDisk(PathSampler& sampler) {
+    double u, v;
+    sampler.Next2D(u, v);
+    double a = 2 * u - 1;
+    double b = 2 * v - 1;
+    if (a == 0 && b == 0) return Vector3(0, 0, 0);
+
+    double r, phi;
+    if (std::fabs(a) > std::fabs(b)) {
+        r = a;
+        phi = (pi / 4) * (b / a);
+    }
+    else {
+        r = b;
+        phi = (pi / 2) - (pi / 4) * (a / b);
+    }
+    return Vector3(r * std::cos(phi), r * std::sin(phi), 0);
+}
+
+#endif
@@ -0,0 +1,424 @@
+#ifndef SCENE_FILE_H
+#define SCENE_FILE_H
+
+#include "Camera.h"
+#include "Hittable.h"
+#include "Material.h"
+#include "RTWeekend.h"
+#include "Sphere.h"
+#include "TriangleMesh.h"
+
+#include <charconv>
+#include <climits>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <vector>
+
+// Text scene descriptions. One statement per line, words separated by spaces or tabs, '#'
+// starts a comment:
+//
+//	camera width 1200 aspect 1.7778 spp 200 depth 50 fov 60 from 0 3 -10 at 0 0.6 10 up 0 1 0
+//	camera defocus 0.6 focus 10 sky on
+//	camera budget 5                            # stop sampling after 5 seconds (Camera::timeBudget)
+//	material ground lambertian 0.2 0.2 0.1
+//	material chrome metal 0.8 0.8 0.8 0.05     # color, then fuzz
+//	material glass dielectric 1.5              # refraction index
+//	material lamp light 15 15 15               # emitted radiance
+//	material wood lambertian texture wood.ppm  # PPM or PFM, relative to the scene file
+//	material brass metal texture brass.ppm 0.3
+//	texturecache 256                           # megabytes of texture tiles kept in memory
+//	sphere 0 -100.5 -11 100 ground             # center, radius, material
+//	mesh torus.obj glass 0 1 0 0.5             # OBJ path, material, position, scale
+//
+// Camera settings are all optional and may be split over several lines; anything not given
+// keeps the Camera's current value. Materials must be declared before they are used. Mesh
+// and texture paths are relative to the scene file; materials naming the same texture share it.
+
+enum class MaterialKind {
+    Lambertian,
+    Metal,
+    Dielectric,
+    Light,
+};
+
+// A built-in material as the file describes it. 'parameter' is the fuzz for Metal and the
+// refraction index for Dielectric.
+struct MaterialDescription {
+    MaterialKind kind;
+    Color color;
+    double parameter = 0;
+};
+
+inline shared_ptr<Material> MakeMaterial(const MaterialDescription& description) {
+    switch (description.kind) {
+    case MaterialKind::Metal: return make_shared<Metal>(description.color, description.parameter);
+    case MaterialKind::Dielectric: return make_shared<Dielectric>(description.parameter);
+    case MaterialKind::Light: return make_shared<DiffuseLight>(description.color);
+    default: return make_shared<Lambertian>(description.color);
+    }
+}
+
+// Writes a scene in the format above. Numbers are printed with enough digits to read back
+// exactly, and lines are collected into a large buffer between writes.
+class SceneWriter {
+public:
+    explicit SceneWriter(const std::string& path) : out(path, std::ios::binary) {}
+    ~SceneWriter() { Flush(); }
+
+    bool Good() { return bool(out); }
+
+    void Comment(const std::string& text) {
+        buffer += "# " + text + "\n";
+    }
+
+    void View(double verticalFov, const Point3& lookFrom, const Point3& lookAt, const Vector3& up, double defocusAngle) {
+        buffer += "camera fov ";
+        AppendNumber(verticalFov);
+        buffer += " from ";
+        AppendVector(lookFrom);
+        buffer += " at ";
+        AppendVector(lookAt);
+        buffer += " up ";
+        AppendVector(up);
+        buffer += " defocus ";
+        AppendNumber(defocusAngle);
+        buffer += "\n";
+    }
+
+    // Materials are named m0, m1, ... in the order they are written; returns the index
+    uint32_t Material(const MaterialDescription& description) {
+        static const char* kinds[] = { "lambertian", "metal", "dielectric", "light" };
+        uint32_t index = materialCount++;
+        buffer += "material m" + std::to_string(index) + " " + kinds[int(description.kind)];
+        if (description.kind != MaterialKind::Dielectric) {
+            buffer += " ";
+            AppendVector(description.color);
+        }
+        if (description.kind == MaterialKind::Metal || description.kind == MaterialKind::Dielectric) {
+            buffer += " ";
+            AppendNumber(description.parameter);
+        }
+        buffer += "\n";
+        return index;
+    }
+
+    void Sphere(const Point3& center, double radius, uint32_t material) {
+        buffer += "sphere ";
+        AppendVector(center);
+        buffer += " ";
+        AppendNumber(radius);
+        buffer += " m" + std::to_string(material) + "\n";
+        if (buffer.size() > flushSize) Flush();
+    }
+
+    void Flush() {
+        out.write(buffer.data(), std::streamsize(buffer.size()));
+        buffer.clear();
+    }
+
+private:
+    static constexpr size_t flushSize = 1 << 20;
+
+    std::ofstream out;
+    std::string buffer;
+    uint32_t materialCount = 0;
+
+    void AppendNumber(double value) {
+        char text[32];
+        auto result = std::to_chars(text, text + sizeof(text), value);
+        buffer.append(text, result.ptr);
+    }
+
+    void AppendVector(const Vector3& value) {
+        AppendNumber(value.x());
+        buffer += " ";
+        AppendNumber(value.y());
+        buffer += " ";
+        AppendNumber(value.z());
+    }
+};
+
+// Reads a scene file into 'objects' and 'camera'. The file is read in fixed-size chunks and
+// parsed in place, so memory use doesn't depend on the file's size beyond the objects it
+// creates. Returns false with 'error' naming the file and line on the first problem.
+//
+// Camera::sceneFingerprint is set from the statements, comments aside, and the path, size and
+// modification time of every mesh and texture, so editing any of them stops a checkpoint of
+// the old scene from being resumed.
+class SceneLoader {
+public:
+    bool Load(const std::string& path, std::vector<shared_ptr<Hittable>>& objects, Camera& camera, std::string& error) {
+        std::ifstream in(path, std::ios::binary);
+        if (!in) {
+            error = "Could not open " + path;
+            return false;
+        }
+        filePath = path;
+        directory = std::filesystem::path(path).parent_path();
+        lineNumber = 0;
+        materials.clear();
+        textures.clear();
+        fingerprint = fingerprintBasis;
+
+        // Whole lines are parsed straight out of the chunk; a partial one at the end is moved
+        // to the front and completed by the next read
+        std::vector<char> chunk(chunkSize);
+        size_t carried = 0;
+        while (true) {
+            in.read(chunk.data() + carried, std::streamsize(chunk.size() - carried));
+            size_t size = carried + size_t(in.gcount());
+            bool finished = size_t(in.gcount()) < chunk.size() - carried;
+
+            size_t lineStart = 0;
+            for (size_t i = 0; i < size; i++) {
+                if (chunk[i] != '\n') continue;
+                if (!ParseLine(std::string_view(chunk.data() + lineStart, i - lineStart), objects, camera, error)) return false;
+                lineStart = i + 1;
+            }
+
+            carried = size - lineStart;
+            if (finished) {
+                if (carried != 0 && !ParseLine(std::string_view(chunk.data() + lineStart, carried), objects, camera, error)) return false;
+                camera.sceneFingerprint = fingerprint;
+                return true;
+            }
+            if (carried == chunk.size()) chunk.resize(chunk.size() * 2); // A single line longer than a chunk
+            std::memmove(chunk.data(), chunk.data() + lineStart, carried);
+        }
+    }
+
+private:
+    static constexpr size_t chunkSize = 1 << 20;
+    static constexpr uint64_t fingerprintBasis = 0xcbf29ce484222325ull;
+
+    std::string filePath;
+    std::filesystem::path directory;
+    size_t lineNumber = 0;
+    std::unordered_map<std::string, shared_ptr<Material>> materials;
+    std::unordered_map<std::string, shared_ptr<ImageTexture>> textures;
+    uint64_t fingerprint = fingerprintBasis;
+
+    // FNV-1a over the bytes of 'text'
+    static uint64_t HashText(uint64_t hash, std::string_view text) {
+        for (char c : text) hash = (hash ^ uint8_t(c)) * 0x100000001b3ull;
+        return hash;
+    }
+
+    // Files are too big to hash whole on every load, so they count as changed when their size
+    // or modification time does
+    static uint64_t HashFile(uint64_t hash, const std::string& path) {
+        std::error_code ignored;
+        uintmax_t size = std::filesystem::file_size(path, ignored);
+        auto modified = std::filesystem::last_write_time(path, ignored).time_since_epoch().count();
+        hash = HashText(hash, path);
+        hash = HashText(hash, std::string_view(reinterpret_cast<const char*>(&size), sizeof(size)));
+        return HashText(hash, std::string_view(reinterpret_cast<const char*>(&modified), sizeof(modified)));
+    }
+
+    // Splits off the next word of 'line', or returns an empty view at the end
+    static std::string_view NextWord(std::string_view& line) {
+        size_t start = 0;
+        while (start < line.size() && (line[start] == ' ' || line[start] == '\t' || line[start] == '\r')) start++;
+        size_t end = start;
+        while (end < line.size() && line[end] != ' ' && line[end] != '\t' && line[end] != '\r') end++;
+        std::string_view word = line.substr(start, end - start);
+        line.remove_prefix(end);
+        return word;
+    }
+
+    static bool ReadNumber(std::string_view& line, double& value) {
+        std::string_view word = NextWord(line);
+        if (!word.empty() && word[0] == '+') word.remove_prefix(1);
+        auto result = std::from_chars(word.data(), word.data() + word.size(), value);
+        return !word.empty() && result.ec == std::errc() && result.ptr == word.data() + word.size();
+    }
+
+    static bool ReadVector(std::string_view& line, Vector3& value) {
+        double x, y, z;
+        if (!ReadNumber(line, x) || !ReadNumber(line, y) || !ReadNumber(line, z)) return false;
+        value = Vector3(x, y, z);
+        return true;
+    }
+
+    bool Fail(std::string& error, const std::string& message) const {
+        error = filePath + ":" + std::to_string(lineNumber) + ": " + message;
+        return false;
+    }
+
+    bool ParseLine(std::string_view line, std::vector<shared_ptr<Hittable>>& objects, Camera& camera, std::string& error) {
+        lineNumber++;
+        size_t comment = line.find('#');
+        if (comment != std::string_view::npos) line = line.substr(0, comment);
+
+        std::string_view statement = line;
+        std::string_view keyword = NextWord(line);
+        if (keyword.empty()) return true;
+        fingerprint = HashText(HashText(fingerprint, statement), "\n");
+
+        if (keyword == "sphere") {
+            Point3 center;
+            double radius;
+            if (!ReadVector(line, center) || !ReadNumber(line, radius)) return Fail(error, "sphere needs a center and a radius");
+            shared_ptr<Material> material;
+            if (!FindMaterial(NextWord(line), material, error)) return false;
+            objects.push_back(make_shared<::Sphere>(center, radius, material));
+        }
+        else if (keyword == "material") {
+            return ParseMaterial(line, error);
+        }
+        else if (keyword == "camera") {
+            return ParseCamera(line, camera, error);
+        }
+        else if (keyword == "texturecache") {
+            double megabytes;
+            if (!ReadNumber(line, megabytes) || megabytes < 0) return Fail(error, "texturecache needs a size in megabytes");
+            TextureCache::Global().SetBudget(size_t(megabytes * 1048576));
+        }
+        else if (keyword == "mesh") {
+            std::string_view file = NextWord(line);
+            shared_ptr<Material> material;
+            if (file.empty()) return Fail(error, "mesh needs an OBJ path");
+            if (!FindMaterial(NextWord(line), material, error)) return false;
+
+            Point3 position(0, 0, 0);
+            double scale = 1;
+            std::string_view rest = line;
+            if (!NextWord(rest).empty() && (!ReadVector(line, position) || !ReadNumber(line, scale)))
+                return Fail(error, "mesh takes a position and a scale after the material");
+
+            std::string meshPath = (directory / std::filesystem::path(std::string(file))).string();
+            auto mesh = make_shared<TriangleMesh>(meshPath, material, position, scale);
+            if (!mesh->Error().empty()) return Fail(error, mesh->Error());
+            if (mesh->TriangleCount() == 0) return Fail(error, meshPath + " has no faces");
+            fingerprint = HashFile(fingerprint, meshPath);
+            objects.push_back(mesh);
+        }
+        else {
+            return Fail(error, "unknown statement '" + std::string(keyword) + "'");
+        }
+        return true;
+    }
+
+    bool FindMaterial(std::string_view name, shared_ptr<Material>& material, std::string& error) const {
+        auto found = materials.find(std::string(name));
+        if (found == materials.end()) return Fail(error, "unknown material '" + std::string(name) + "'");
+        material = found->second;
+        return true;
+    }
+
+    bool ParseMaterial(std::string_view line, std::string& error) {
+        std::string name(NextWord(line));
+        std::string_view kind = NextWord(line);
+        if (name.empty()) return Fail(error, "material needs a name");
+
+        std::string_view rest = line;
+        if ((kind == "lambertian" || kind == "metal") && NextWord(rest) == "texture") {
+            shared_ptr<ImageTexture> texture;
+            if (!FindTexture(NextWord(rest), texture, error)) return false;
+            double fuzz = 0;
+            if (kind == "metal" && !ReadNumber(rest, fuzz)) return Fail(error, "textured metal '" + name + "' needs a fuzz");
+            if (kind == "metal") materials[name] = make_shared<Metal>(texture, fuzz);
+            else materials[name] = make_shared<Lambertian>(texture);
+            return true;
+        }
+
+        MaterialDescription description;
+        bool valid;
+        if (kind == "lambertian") {
+            description.kind = MaterialKind::Lambertian;
+            valid = ReadVector(line, description.color);
+        }
+        else if (kind == "metal") {
+            description.kind = MaterialKind::Metal;
+            valid = ReadVector(line, description.color) && ReadNumber(line, description.parameter);
+        }
+        else if (kind == "dielectric") {
+            description.kind = MaterialKind::Dielectric;
+            valid = ReadNumber(line, description.parameter);
+        }
+        else if (kind == "light") {
+            description.kind = MaterialKind::Light;
+            valid = ReadVector(line, description.color);
+        }
+        else {
+            return Fail(error, "unknown material type '" + std::string(kind) + "'");
+        }
+        if (!valid) return Fail(error, "wrong parameters for " + std::string(kind) + " material '" + name + "'");
+
+        materials[name] = MakeMaterial(description);
+        return true;
+    }
+
+    bool FindTexture(std::string_view file, shared_ptr<ImageTexture>& texture, std::string& error) {
+        if (file.empty()) return Fail(error, "texture needs an image path");
+        std::string texturePath = (directory / std::filesystem::path(std::string(file))).string();
+        shared_ptr<ImageTexture>& loaded = textures[texturePath];
+        if (!loaded) {
+            loaded = make_shared<ImageTexture>(texturePath);
+            if (!loaded->Valid()) {
+                std::string message = loaded->Error();
+                textures.erase(texturePath);
+                return Fail(error, message);
+            }
+        }
+        texture = loaded;
+        fingerprint = HashFile(fingerprint, texturePath);
+        return true;
+    }
+
+    bool ParseCamera(std::string_view line, Camera& camera, std::string& error) const {
+        while (true) {
+            std::string_view key = NextWord(line);
+            if (key.empty()) return true;
+
+            double number;
+            bool valid = true;
+            const char* expected = nullptr; // The range a number must be in, for the error
+            if (key == "from") valid = ReadVector(line, camera.lookFrom);
+            else if (key == "at") valid = ReadVector(line, camera.lookAt);
+            else if (key == "up") valid = ReadVector(line, camera.up);
+            else if (key == "sky") {
+                std::string_view value = NextWord(line);
+                valid = value == "on" || value == "off";
+                camera.skyLight = value == "on";
+            }
+            else if (!ReadNumber(line, number)) valid = false;
+            else if (key == "width") {
+                // Passes are planned per pixel, so an image needs at least one
+                valid = number >= 1 && number <= INT_MAX;
+                expected = "at least 1";
+                camera.imageWidth = valid ? int(number) : camera.imageWidth;
+            }
+            else if (key == "aspect") {
+                valid = number > 0;
+                expected = "above 0";
+                camera.aspectRatio = valid ? number : camera.aspectRatio;
+            }
+            else if (key == "spp") {
+                // Passes plan each pixel's samples as 16-bit counts
+                valid = number >= 1 && number <= UINT16_MAX;
+                expected = "from 1 to 65535";
+                camera.samplesPerPixel = valid ? int(number) : camera.samplesPerPixel;
+            }
+            else if (key == "depth") {
+                valid = number >= 1 && number <= INT_MAX;
+                expected = "at least 1";
+                camera.maxDepth = valid ? int(number) : camera.maxDepth;
+            }
+            else if (key == "fov") camera.verticalFov = number;
+            else if (key == "defocus") camera.defocusAngle = number;
+            else if (key == "focus") camera.focusDistance = number;
+            else if (key == "budget") camera.timeBudget = number;
+            else return Fail(error, "unknown camera setting '" + std::string(key) + "'");
+
+            if (!valid && expected) return Fail(error, "camera " + std::string(key) + " must be " + expected);
+            if (!valid) return Fail(error, "bad value for camera setting '" + std::string(key) + "'");
+        }
+    }
+};
+
+#endif
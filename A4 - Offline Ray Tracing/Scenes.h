@@ -0,0 +1,119 @@
+#ifndef SCENES_H
+#define SCENES_H
+
+#include "Camera.h"
+#include "HittableList.h"
+#include "Material.h"
+#include "RTWeekend.h"
+#include "SceneFile.h"
+#include "Sphere.h"
+
+#include <cmath>
+#include <vector>
+
+// Scenes shared by the renderer and the benchmark. Each one fills in the objects and points the
+// camera; image size, sampling and output are left to the caller.
+
+// Two big spheres, a mirror and a diamond, behind four small diffuse ones
+inline void MainScene(HittableList& world, Camera& camera) {
+    // Ground
+    world.Add(make_shared<Sphere>(Point3(0, -100.5, -11), 100, make_shared<Lambertian>(Color(0.2, 0.2, 0.1))));
+
+    // Big Mirror (Metal)
+    world.Add(make_shared<Sphere>(Point3(-6, 1, 4), 5.5, make_shared<Metal>(Color(0.4, 0.6, 1), 0)));
+
+    // Big Diamond Ball (Dielectric)
+    world.Add(make_shared<Sphere>(Point3(6, 1, 4), 5.5, make_shared<Dielectric>(2.4)));
+
+    // 4 Lambertian Spheres
+    world.Add(make_shared<Sphere>(Point3(2.6, -0.2, -4), 1, make_shared<Lambertian>(Color(0.537, 0.92, 0.794))));
+    world.Add(make_shared<Sphere>(Point3(0.8, -0.3, -4), 0.7, make_shared<Lambertian>(Color(0.47, 0.66, 0.98))));
+    world.Add(make_shared<Sphere>(Point3(-0.8, -0.3, -4), 0.7, make_shared<Lambertian>(Color(0.945, 0.78, 0.85))));
+    world.Add(make_shared<Sphere>(Point3(-2.6, 0, -4), 1, make_shared<Lambertian>(Color(0.96, 0.86, 0.43))));
+
+    camera.verticalFov = 60;
+    camera.lookFrom = Point3(0, 3, -10);
+    camera.lookAt = Point3(0, 0.6, 10);
+    camera.up = Vector3(0, 9, 0);
+
+    camera.defocusAngle = 0.6;
+    camera.focusDistance = 10;
+}
+
+// A square field of 'count' small spheres on a large ground sphere, one per grid cell with a
+// random offset, size and material, seen from above one corner. The same seed always gives
+// the same field. Materials come from a fixed palette, so the material table stays small
+// however many spheres there are.
+//
+// The field is described to 'builder', which needs
+//	uint32_t Material(const MaterialDescription&)   returning an index for Sphere
+//	void Sphere(const Point3& center, double radius, uint32_t material)
+//	void View(double verticalFov, const Point3& lookFrom, const Point3& lookAt, const Vector3& up, double defocusAngle)
+// so the same field can be built in memory or written out as a scene file with SceneWriter.
+template <typename Builder>
+void SphereField(size_t count, uint64_t seed, Builder& builder) {
+    Rng rng(seed, 0);
+    std::vector<uint32_t> palette;
+    for (int i = 0; i < 16; i++) {
+        Color color(0.1 + 0.8 * rng.NextDouble(), 0.1 + 0.8 * rng.NextDouble(), 0.1 + 0.8 * rng.NextDouble());
+        if (i < 10) palette.push_back(builder.Material({ MaterialKind::Lambertian, color }));
+        else if (i < 14) palette.push_back(builder.Material({ MaterialKind::Metal, color, 0.3 * rng.NextDouble() }));
+        else palette.push_back(builder.Material({ MaterialKind::Dielectric, color, 1.5 }));
+    }
+
+    int side = int(std::ceil(std::sqrt(double(count))));
+    double half = 0.5 * side;
+    double groundRadius = std::fmax(1000.0, 10.0 * side);
+
+    builder.Sphere(Point3(0, -groundRadius, 0), groundRadius, builder.Material({ MaterialKind::Lambertian, Color(0.5, 0.5, 0.5) }));
+    for (size_t i = 0; i < count; i++) {
+        double radius = 0.1 + 0.15 * rng.NextDouble();
+        double x = double(i % side) - half + 0.5 + (1 - 2 * radius) * (rng.NextDouble() - 0.5);
+        double z = double(i / side) - half + 0.5 + (1 - 2 * radius) * (rng.NextDouble() - 0.5);
+        // Rest on the ground sphere's curved surface
+        double y = std::sqrt(groundRadius * groundRadius - x * x - z * z) - groundRadius + radius;
+        size_t material = size_t(rng.NextUInt() % palette.size());
+        builder.Sphere(Point3(x, y, z), radius, palette[material]);
+    }
+
+    builder.View(35, Point3(-half - 2, 6, -half - 2), Point3(-half + 12, 0, -half + 12), Vector3(0, 1, 0), 0);
+}
+
+// Builds a scene straight into a flat object list and the camera
+class SceneBuilder {
+public:
+    SceneBuilder(std::vector<shared_ptr<Hittable>>& objects, Camera& camera) : objects(objects), camera(camera) {}
+
+    uint32_t Material(const MaterialDescription& description) {
+        materials.push_back(MakeMaterial(description));
+        return uint32_t(materials.size() - 1);
+    }
+
+    void Sphere(const Point3& center, double radius, uint32_t material) {
+        objects.push_back(make_shared<::Sphere>(center, radius, materials[material]));
+    }
+
+    void View(double verticalFov, const Point3& lookFrom, const Point3& lookAt, const Vector3& up, double defocusAngle) {
+        camera.verticalFov = verticalFov;
+        camera.lookFrom = lookFrom;
+        camera.lookAt = lookAt;
+        camera.up = up;
+        camera.defocusAngle = defocusAngle;
+    }
+
+private:
+    std::vector<shared_ptr<Hittable>>& objects;
+    Camera& camera;
+    std::vector<shared_ptr<::Material>> materials;
+};
+
+// SphereField as a flat list for a BVH or WideBVH
+inline std::vector<shared_ptr<Hittable>> RandomSpheres(size_t count, uint64_t seed, Camera& camera) {
+    std::vector<shared_ptr<Hittable>> objects;
+    objects.reserve(count + 1);
+    SceneBuilder builder(objects, camera);
+    SphereField(count, seed, builder);
+    return objects;
+}
+
+#endif
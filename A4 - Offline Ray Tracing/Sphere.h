@@ -2,12 +2,30 @@
 #define SPHERE_H
 
 #include "Hittable.h"
+#include "LightList.h"
+#include "MaterialTable.h"
+
+#include <algorithm>
 
 class Sphere : public Hittable {
 public:
-    Sphere(const Point3& center, double radius, shared_ptr<Material> material) : center(center), radius(std::fmax(0, radius)), material(material) {}
+    Sphere(const Point3& center, double radius, shared_ptr<Material> material)
+        : center(center), radius(std::fmax(0, radius)), materialId(MaterialTable::Global().Add(material)) {
+        Vector3 radiusVector = Vector3(this->radius, this->radius, this->radius);
+        bbox = AABB(center - radiusVector, center + radiusVector);
+    }
 
     bool Hit(const Ray& ray, Interval rayT, HitRecord& record) const override {
+        TRACE_COUNT(hitCalls);
+        if (!Intersect(center, radius, ray, rayT, record.t)) return false;
+        record.object = this;
+        record.primitiveId = 0;
+        return true;
+    }
+
+    // The quadratic on its own, for callers that keep sphere data elsewhere
+    static bool Intersect(const Point3& center, double radius, const Ray& ray, const Interval& rayT, double& t) {
+        TRACE_COUNT(primitiveTests);
         Vector3 originToCenter = center - ray.Origin();
         double a = ray.Direction().LengthSquared();
         double h = Dot(ray.Direction(), originToCenter);
@@ -26,19 +44,48 @@ public:
                 return false;
         }
 
-        record.t = root;
+        t = root;
+        return true;
+    }
+
+    void ComputeSurface(const Ray& ray, HitRecord& record) const override {
         record.point = ray.At(record.t);
         Vector3 outwardNormal = (record.point - center) / radius;
         record.SetFaceNormal(ray, outwardNormal);
-        record.material = material;
+        record.materialId = materialId;
+    }
 
-        return true;
+    void ComputeTextureCoordinates(const Ray& ray, HitRecord& record) const override {
+        TextureCoordinates(center, radius, ray.At(record.t), record);
+    }
+
+    // Longitude and latitude: u runs around the y axis starting at -x and v up from the bottom pole
+    static void TextureCoordinates(const Point3& center, double radius, const Point3& point, HitRecord& record) {
+        Vector3 direction = (point - center) / radius;
+        double theta = std::acos(std::clamp(-direction.y(), -1.0, 1.0));
+        double phi = std::atan2(-direction.z(), direction.x()) + pi;
+        record.textureU = phi / (2 * pi);
+        record.textureV = theta / pi;
+        // v changes by 1/(pi r) per unit along a meridian and u by 1/(2 pi r sin(theta)) around
+        // a parallel; the denser of the two picks the level, so textures blur toward the poles
+        record.textureScale = 1 / (pi * radius * std::clamp(2 * std::sin(theta), 1e-6, 1.0));
     }
 
+    void CollectLights(LightList& lights) const override {
+        lights.AddSphere(center, radius, materialId, this, 0);
+    }
+
+    AABB BoundingBox() const override { return bbox; }
+
+    const Point3& Center() const { return center; }
+    double Radius() const { return radius; }
+    uint32_t MaterialId() const { return materialId; }
+
 private:
     Point3 center;
     double radius;
-    shared_ptr<Material> material;
+    uint32_t materialId;
+    AABB bbox;
 };
 
 #endif
\ No newline at end of file
@@ -0,0 +1,387 @@
+#ifndef SPHERE_SET_H
+#define SPHERE_SET_H
+
+#include "Hittable.h"
+#include "LightList.h"
+#include "MaterialTable.h"
+#include "Sphere.h"
+
+#include <cstdint>
+#include <limits>
+#include <vector>
+
+#if defined(__AVX2__)
+#include <immintrin.h>
+#endif
+
+enum class Precision {
+    Automatic, // Mixed once there are enough small spheres to pay for the extra bookkeeping
+    Double,    // Every sphere is tested in double
+    Mixed,     // Small spheres are culled in float, twice as many per instruction; the winner is re-tested in double
+};
+
+// Spheres stored as structure-of-arrays so one ray can be tested against four of them per
+// AVX2 instruction. Arrays are padded to a multiple of the batch width with spheres that can
+// never be hit, which keeps the kernel free of tail handling.
+class SphereSet : public Hittable {
+public:
+    static constexpr int batchWidth = 4;
+    static constexpr int floatBatchWidth = 8;
+
+    // Above this radius float can't resolve |center - origin|^2 - radius^2 near the surface, so
+    // rays leaving the sphere would see themselves; such spheres stay in double in Mixed mode.
+    static constexpr double floatRadiusLimit = 10;
+    // Below this many small spheres the float pass doesn't save enough batches to win
+    static constexpr size_t mixedThreshold = 48;
+
+    Precision precision = Precision::Automatic;
+
+    void Add(const Point3& center, double radius, shared_ptr<Material> material) {
+        Add(center, radius, MaterialTable::Global().Add(material));
+    }
+
+    void Add(const Point3& center, double radius, uint32_t materialId) {
+        // Overwrite the first padding slot if there is one, otherwise grow by a whole batch
+        if (count == centerX.size()) {
+            for (int i = 0; i < batchWidth; i++) {
+                centerX.push_back(0);
+                centerY.push_back(0);
+                centerZ.push_back(0);
+                radiusSquared.push_back(-infinity); // Drives the discriminant to -inf
+                radii.push_back(0);
+                materialIds.push_back(0);
+            }
+        }
+
+        centerX[count] = center.x();
+        centerY[count] = center.y();
+        centerZ[count] = center.z();
+        radii[count] = std::fmax(0, radius);
+        radiusSquared[count] = radii[count] * radii[count];
+        materialIds[count] = materialId;
+
+        if (radii[count] > floatRadiusLimit) {
+            largeSpheres.push_back(uint32_t(count));
+        }
+        else {
+            if (floatCount == floatCenterX.size()) {
+                for (int i = 0; i < floatBatchWidth; i++) {
+                    floatCenterX.push_back(0);
+                    floatCenterY.push_back(0);
+                    floatCenterZ.push_back(0);
+                    floatRadiusSquared.push_back(-std::numeric_limits<float>::infinity());
+                    floatSpheres.push_back(0);
+                }
+            }
+            floatCenterX[floatCount] = float(center.x());
+            floatCenterY[floatCount] = float(center.y());
+            floatCenterZ[floatCount] = float(center.z());
+            floatRadiusSquared[floatCount] = float(radiusSquared[count]);
+            floatSpheres[floatCount] = uint32_t(count);
+            floatCount++;
+        }
+        count++;
+
+        Vector3 radiusVector(radii[count - 1], radii[count - 1], radii[count - 1]);
+        bbox = AABB(bbox, AABB(center - radiusVector, center + radiusVector));
+    }
+
+    void Add(const Sphere& sphere) {
+        Add(sphere.Center(), sphere.Radius(), sphere.MaterialId());
+    }
+
+    size_t Size() const { return count; }
+
+    bool Hit(const Ray& ray, Interval rayT, HitRecord& record) const override {
+        TRACE_COUNT(hitCalls);
+        TRACE_ADD(primitiveTests, count);
+        if (count == 0) return false;
+
+        double closest = rayT.max;
+        int64_t closestIndex = -1;
+
+        bool mixed = precision == Precision::Mixed || (precision == Precision::Automatic && floatCount >= mixedThreshold);
+        if (mixed)
+            IntersectMixed(ray, rayT, closest, closestIndex);
+        else
+            IntersectDouble(ray, rayT.min, closest, closestIndex);
+        if (closestIndex < 0) return false;
+
+        record.t = closest;
+        record.object = this;
+        record.primitiveId = uint32_t(closestIndex);
+        return true;
+    }
+
+    void ComputeSurface(const Ray& ray, HitRecord& record) const override {
+        uint32_t i = record.primitiveId;
+        Point3 center(centerX[i], centerY[i], centerZ[i]);
+        record.point = ray.At(record.t);
+        Vector3 outwardNormal = (record.point - center) / radii[i];
+        record.SetFaceNormal(ray, outwardNormal);
+        record.materialId = materialIds[i];
+    }
+
+    void ComputeTextureCoordinates(const Ray& ray, HitRecord& record) const override {
+        uint32_t i = record.primitiveId;
+        Sphere::TextureCoordinates(Point3(centerX[i], centerY[i], centerZ[i]), radii[i], ray.At(record.t), record);
+    }
+
+    void CollectLights(LightList& lights) const override {
+        for (size_t i = 0; i < count; i++)
+            lights.AddSphere(Point3(centerX[i], centerY[i], centerZ[i]), radii[i], materialIds[i], this, uint32_t(i));
+    }
+
+    AABB BoundingBox() const override { return bbox; }
+
+private:
+    size_t count = 0;
+    std::vector<double> centerX, centerY, centerZ, radii, radiusSquared;
+    std::vector<uint32_t> materialIds;
+
+    // Float copies of the spheres under floatRadiusLimit, padded to floatBatchWidth, and the
+    // index each slot came from. Larger spheres are listed in largeSpheres instead.
+    size_t floatCount = 0;
+    std::vector<float> floatCenterX, floatCenterY, floatCenterZ, floatRadiusSquared;
+    std::vector<uint32_t> floatSpheres;
+    std::vector<uint32_t> largeSpheres;
+    AABB bbox;
+
+    void IntersectDouble(const Ray& ray, double tMin, double& closest, int64_t& closestIndex) const {
+#if defined(__AVX2__)
+        Intersect4(ray, tMin, closest, closestIndex);
+#else
+        for (size_t i = 0; i < count; i++)
+            IntersectOne(ray, i, tMin, closest, closestIndex);
+#endif
+    }
+
+    void IntersectMixed(const Ray& ray, const Interval& rayT, double& closest, int64_t& closestIndex) const {
+        for (uint32_t i : largeSpheres)
+            IntersectOne(ray, i, rayT.min, closest, closestIndex);
+        if (floatCount == 0) return;
+
+        // Float only picks the candidate; its distance is recomputed in double. The bounds are
+        // widened by float rounding so a hit right at either end isn't lost to it.
+        Rayf floatRay(ray);
+        Intervalf floatT(float(rayT.min) * (1 - 1e-5f), float(closest) * (1 + 1e-5f));
+        int64_t candidate = -1;
+#if defined(__AVX2__)
+        IntersectFloat8(floatRay, floatT, candidate);
+#else
+        for (size_t slot = 0; slot < floatCount; slot++)
+            IntersectOneFloat(floatRay, slot, floatT, candidate);
+#endif
+        if (candidate < 0) return;
+
+        // Accept the double result unless it lands clearly past where float put the candidate,
+        // since spheres float saw behind that point were never considered
+        double refinedT = rayT.max;
+        int64_t refinedIndex = -1;
+        IntersectOne(ray, floatSpheres[size_t(candidate)], rayT.min, refinedT, refinedIndex);
+        if (refinedIndex >= 0 && refinedT <= double(floatT.max) * (1 + 1e-4) + 1e-6) {
+            if (refinedT < closest) {
+                closest = refinedT;
+                closestIndex = refinedIndex;
+            }
+            return;
+        }
+
+        // Float and double disagree about the candidate, which only happens for grazing rays or
+        // rays leaving a sphere's surface; redo the whole set in double rather than guess
+        closest = rayT.max;
+        closestIndex = -1;
+        IntersectDouble(ray, rayT.min, closest, closestIndex);
+    }
+
+    void IntersectOneFloat(const Rayf& ray, size_t slot, Intervalf& rayT, int64_t& candidate) const {
+        Vector3f originToCenter = Point3f(floatCenterX[slot], floatCenterY[slot], floatCenterZ[slot]) - ray.Origin();
+        float a = ray.Direction().LengthSquared();
+        float h = Dot(ray.Direction(), originToCenter);
+        float c = originToCenter.LengthSquared() - floatRadiusSquared[slot];
+
+        float discriminant = h * h - a * c;
+        if (discriminant < 0) return;
+
+        float sqrtd = std::sqrt(discriminant);
+        float root = (h - sqrtd) / a;
+        if (!rayT.Surrounds(root)) {
+            root = (h + sqrtd) / a;
+            if (!rayT.Surrounds(root)) return;
+        }
+
+        rayT.max = root;
+        candidate = int64_t(slot);
+    }
+
+    // Same quadratic as Sphere::Hit, keeping only the distance and index of the nearest root
+    void IntersectOne(const Ray& ray, size_t i, double tMin, double& closest, int64_t& closestIndex) const {
+        Vector3 originToCenter = Point3(centerX[i], centerY[i], centerZ[i]) - ray.Origin();
+        double a = ray.Direction().LengthSquared();
+        double h = Dot(ray.Direction(), originToCenter);
+        double c = originToCenter.LengthSquared() - radiusSquared[i];
+
+        double discriminant = h * h - a * c;
+        if (discriminant < 0) return;
+
+        double sqrtd = sqrt(discriminant);
+        double root = (h - sqrtd) / a;
+        if (root <= tMin || root >= closest) {
+            root = (h + sqrtd) / a;
+            if (root <= tMin || root >= closest) return;
+        }
+
+        closest = root;
+        closestIndex = int64_t(i);
+    }
+
+#if defined(__AVX2__)
+    static __m256d MultiplyAdd(__m256d a, __m256d b, __m256d c) {
+#if defined(__FMA__) || defined(_MSC_VER)
+        return _mm256_fmadd_pd(a, b, c);
+#else
+        return _mm256_add_pd(_mm256_mul_pd(a, b), c);
+#endif
+    }
+
+    void Intersect4(const Ray& ray, double tMin, double& closest, int64_t& closestIndex) const {
+        const Point3& origin = ray.Origin();
+        const Vector3& direction = ray.Direction();
+
+        __m256d originX = _mm256_set1_pd(origin.x());
+        __m256d originY = _mm256_set1_pd(origin.y());
+        __m256d originZ = _mm256_set1_pd(origin.z());
+        __m256d directionX = _mm256_set1_pd(direction.x());
+        __m256d directionY = _mm256_set1_pd(direction.y());
+        __m256d directionZ = _mm256_set1_pd(direction.z());
+        __m256d a = _mm256_set1_pd(direction.LengthSquared());
+        __m256d minimum = _mm256_set1_pd(tMin);
+        __m256d zero = _mm256_setzero_pd();
+
+        // Each lane tracks its own nearest hit; the lanes are reduced once at the end
+        __m256d bestT = _mm256_set1_pd(closest);
+        __m256i bestIndex = _mm256_set1_epi64x(-1);
+        __m256i index = _mm256_setr_epi64x(0, 1, 2, 3);
+        const __m256i step = _mm256_set1_epi64x(batchWidth);
+
+        size_t padded = centerX.size();
+        for (size_t i = 0; i < padded; i += batchWidth) {
+            __m256d toCenterX = _mm256_sub_pd(_mm256_loadu_pd(&centerX[i]), originX);
+            __m256d toCenterY = _mm256_sub_pd(_mm256_loadu_pd(&centerY[i]), originY);
+            __m256d toCenterZ = _mm256_sub_pd(_mm256_loadu_pd(&centerZ[i]), originZ);
+
+            __m256d h = MultiplyAdd(directionZ, toCenterZ, MultiplyAdd(directionY, toCenterY, _mm256_mul_pd(directionX, toCenterX)));
+            __m256d lengthSquared = MultiplyAdd(toCenterZ, toCenterZ, MultiplyAdd(toCenterY, toCenterY, _mm256_mul_pd(toCenterX, toCenterX)));
+            __m256d c = _mm256_sub_pd(lengthSquared, _mm256_loadu_pd(&radiusSquared[i]));
+            __m256d discriminant = _mm256_sub_pd(_mm256_mul_pd(h, h), _mm256_mul_pd(a, c));
+
+            __m256d valid = _mm256_cmp_pd(discriminant, zero, _CMP_GE_OQ);
+            if (_mm256_movemask_pd(valid) == 0) {
+                index = _mm256_add_epi64(index, step);
+                continue;
+            }
+
+            __m256d sqrtd = _mm256_sqrt_pd(_mm256_max_pd(discriminant, zero));
+            __m256d nearRoot = _mm256_div_pd(_mm256_sub_pd(h, sqrtd), a);
+            __m256d farRoot = _mm256_div_pd(_mm256_add_pd(h, sqrtd), a);
+
+            // Prefer the near root, falling back to the far one when the near one is out of range
+            __m256d nearValid = _mm256_and_pd(_mm256_cmp_pd(nearRoot, minimum, _CMP_GT_OQ), _mm256_cmp_pd(nearRoot, bestT, _CMP_LT_OQ));
+            __m256d farValid = _mm256_and_pd(_mm256_cmp_pd(farRoot, minimum, _CMP_GT_OQ), _mm256_cmp_pd(farRoot, bestT, _CMP_LT_OQ));
+            __m256d root = _mm256_blendv_pd(farRoot, nearRoot, nearValid);
+            __m256d hit = _mm256_and_pd(valid, _mm256_or_pd(nearValid, farValid));
+
+            bestT = _mm256_blendv_pd(bestT, root, hit);
+            bestIndex = _mm256_castpd_si256(_mm256_blendv_pd(_mm256_castsi256_pd(bestIndex), _mm256_castsi256_pd(index), hit));
+            index = _mm256_add_epi64(index, step);
+        }
+
+        alignas(32) double laneT[batchWidth];
+        alignas(32) int64_t laneIndex[batchWidth];
+        _mm256_store_pd(laneT, bestT);
+        _mm256_store_si256(reinterpret_cast<__m256i*>(laneIndex), bestIndex);
+        for (int lane = 0; lane < batchWidth; lane++) {
+            if (laneIndex[lane] >= 0 && laneT[lane] < closest) {
+                closest = laneT[lane];
+                closestIndex = laneIndex[lane];
+            }
+        }
+    }
+
+    static __m256 MultiplyAdd(__m256 a, __m256 b, __m256 c) {
+#if defined(__FMA__) || defined(_MSC_VER)
+        return _mm256_fmadd_ps(a, b, c);
+#else
+        return _mm256_add_ps(_mm256_mul_ps(a, b), c);
+#endif
+    }
+
+    // Intersect4 at float precision, eight spheres at a time. Returns the float slot of the
+    // nearest candidate, not a sphere index.
+    void IntersectFloat8(const Rayf& ray, Intervalf& rayT, int64_t& candidate) const {
+        const Point3f& origin = ray.Origin();
+        const Vector3f& direction = ray.Direction();
+
+        __m256 originX = _mm256_set1_ps(origin.x());
+        __m256 originY = _mm256_set1_ps(origin.y());
+        __m256 originZ = _mm256_set1_ps(origin.z());
+        __m256 directionX = _mm256_set1_ps(direction.x());
+        __m256 directionY = _mm256_set1_ps(direction.y());
+        __m256 directionZ = _mm256_set1_ps(direction.z());
+        __m256 inverseA = _mm256_set1_ps(1 / direction.LengthSquared());
+        __m256 a = _mm256_set1_ps(direction.LengthSquared());
+        __m256 minimum = _mm256_set1_ps(rayT.min);
+        __m256 zero = _mm256_setzero_ps();
+
+        __m256 bestT = _mm256_set1_ps(rayT.max);
+        __m256i bestSlot = _mm256_set1_epi32(-1);
+        __m256i slot = _mm256_setr_epi32(0, 1, 2, 3, 4, 5, 6, 7);
+        const __m256i step = _mm256_set1_epi32(floatBatchWidth);
+
+        size_t padded = floatCenterX.size();
+        for (size_t i = 0; i < padded; i += floatBatchWidth) {
+            __m256 toCenterX = _mm256_sub_ps(_mm256_loadu_ps(&floatCenterX[i]), originX);
+            __m256 toCenterY = _mm256_sub_ps(_mm256_loadu_ps(&floatCenterY[i]), originY);
+            __m256 toCenterZ = _mm256_sub_ps(_mm256_loadu_ps(&floatCenterZ[i]), originZ);
+
+            __m256 h = MultiplyAdd(directionZ, toCenterZ, MultiplyAdd(directionY, toCenterY, _mm256_mul_ps(directionX, toCenterX)));
+            __m256 lengthSquared = MultiplyAdd(toCenterZ, toCenterZ, MultiplyAdd(toCenterY, toCenterY, _mm256_mul_ps(toCenterX, toCenterX)));
+            __m256 c = _mm256_sub_ps(lengthSquared, _mm256_loadu_ps(&floatRadiusSquared[i]));
+            __m256 discriminant = _mm256_sub_ps(_mm256_mul_ps(h, h), _mm256_mul_ps(a, c));
+
+            __m256 valid = _mm256_cmp_ps(discriminant, zero, _CMP_GE_OQ);
+            if (_mm256_movemask_ps(valid) == 0) {
+                slot = _mm256_add_epi32(slot, step);
+                continue;
+            }
+
+            // Candidates don't need exact roots, so divide once via the reciprocal
+            __m256 sqrtd = _mm256_sqrt_ps(_mm256_max_ps(discriminant, zero));
+            __m256 nearRoot = _mm256_mul_ps(_mm256_sub_ps(h, sqrtd), inverseA);
+            __m256 farRoot = _mm256_mul_ps(_mm256_add_ps(h, sqrtd), inverseA);
+
+            __m256 nearValid = _mm256_and_ps(_mm256_cmp_ps(nearRoot, minimum, _CMP_GT_OQ), _mm256_cmp_ps(nearRoot, bestT, _CMP_LT_OQ));
+            __m256 farValid = _mm256_and_ps(_mm256_cmp_ps(farRoot, minimum, _CMP_GT_OQ), _mm256_cmp_ps(farRoot, bestT, _CMP_LT_OQ));
+            __m256 root = _mm256_blendv_ps(farRoot, nearRoot, nearValid);
+            __m256 hit = _mm256_and_ps(valid, _mm256_or_ps(nearValid, farValid));
+
+            bestT = _mm256_blendv_ps(bestT, root, hit);
+            bestSlot = _mm256_castps_si256(_mm256_blendv_ps(_mm256_castsi256_ps(bestSlot), _mm256_castsi256_ps(slot), hit));
+            slot = _mm256_add_epi32(slot, step);
+        }
+
+        alignas(32) float laneT[floatBatchWidth];
+        alignas(32) int32_t laneSlot[floatBatchWidth];
+        _mm256_store_ps(laneT, bestT);
+        _mm256_store_si256(reinterpret_cast<__m256i*>(laneSlot), bestSlot);
+        for (int lane = 0; lane < floatBatchWidth; lane++) {
+            if (laneSlot[lane] >= 0 && laneT[lane] < rayT.max) {
+                rayT.max = laneT[lane];
+                candidate = laneSlot[lane];
+            }
+        }
+    }
+#endif
+};
+
+#endif
@@ -0,0 +1,116 @@
+#ifndef STATISTICS_H
+#define STATISTICS_H
+
+#include <algorithm>
+#include <cstdint>
+#include <mutex>
+#include <vector>
+
+// Opt-in counters for where tracing time goes. Build with RT_STATISTICS defined to have the
+// renderer count the work below, report it after each Render and fill Camera's cost map;
+// without it the TRACE_ macros expand to nothing and none of this is touched. Every thread
+// counts into its own TraceCounters, and Collect adds them up once the work is done, so no
+// counter is ever shared between threads.
+#if defined(RT_STATISTICS)
+#define TRACE_COUNT(counter) (TraceCounters::Local().counter++)
+#define TRACE_ADD(counter, amount) (TraceCounters::Local().counter += (amount))
+#else
+#define TRACE_COUNT(counter) ((void)0)
+#define TRACE_ADD(counter, amount) ((void)0)
+#endif
+
+enum class ScatterKind {
+    Lambertian,
+    Metal,
+    Dielectric,
+    Light,
+    Other,
+    Count,
+};
+
+inline const char* ScatterKindName(ScatterKind kind) {
+    static const char* names[] = { "Lambertian", "Metal", "Dielectric", "DiffuseLight", "other" };
+    return names[int(kind)];
+}
+
+struct TraceCounters {
+    static constexpr uint32_t maxPathLength = 64; // Longer paths share the last histogram bin
+
+    uint64_t hitCalls = 0;       // Hittable::Hit calls, including those nested in lists, BVHs and instances
+    uint64_t nodesVisited = 0;   // BVH and WideBVH nodes whose children or bounds were tested
+    uint64_t primitiveTests = 0; // Ray-sphere and ray-triangle intersection tests
+    uint64_t scatterCalls[int(ScatterKind::Count)] = {};
+    uint64_t pathLengths[maxPathLength + 1] = {}; // Paths by rays traced, camera ray included
+
+    // Traversal work, the cost the per-pixel cost map shows
+    uint64_t Work() const { return nodesVisited + primitiveTests; }
+
+    void Add(const TraceCounters& other) {
+        hitCalls += other.hitCalls;
+        nodesVisited += other.nodesVisited;
+        primitiveTests += other.primitiveTests;
+        for (int kind = 0; kind < int(ScatterKind::Count); kind++) scatterCalls[kind] += other.scatterCalls[kind];
+        for (uint32_t length = 0; length <= maxPathLength; length++) pathLengths[length] += other.pathLengths[length];
+    }
+
+    // This thread's counters
+    static TraceCounters& Local();
+
+    // Totals over every thread since the last Reset. Only call these while no thread is
+    // counting, such as between renders.
+    static TraceCounters Collect();
+    static void Reset();
+};
+
+namespace TraceCounterDetail {
+    // Counters of the running threads, plus what threads that have exited left behind
+    struct Registry {
+        std::mutex mutex;
+        std::vector<TraceCounters*> live;
+        TraceCounters retired;
+
+        static Registry& Get() {
+            static Registry registry;
+            return registry;
+        }
+    };
+
+    struct Slot {
+        TraceCounters counters;
+
+        Slot() {
+            Registry& registry = Registry::Get();
+            std::lock_guard<std::mutex> lock(registry.mutex);
+            registry.live.push_back(&counters);
+        }
+
+        ~Slot() {
+            Registry& registry = Registry::Get();
+            std::lock_guard<std::mutex> lock(registry.mutex);
+            registry.retired.Add(counters);
+            registry.live.erase(std::find(registry.live.begin(), registry.live.end(), &counters));
+        }
+    };
+}
+
+inline TraceCounters& TraceCounters::Local() {
+    thread_local TraceCounterDetail::Slot slot;
+    return slot.counters;
+}
+
+inline TraceCounters TraceCounters::Collect() {
+    TraceCounterDetail::Registry& registry = TraceCounterDetail::Registry::Get();
+    std::lock_guard<std::mutex> lock(registry.mutex);
+    TraceCounters total = registry.retired;
+    for (const TraceCounters* counters : registry.live) total.Add(*counters);
+    return total;
+}
+
+inline void TraceCounters::Reset() {
+    TraceCounterDetail::Registry& registry = TraceCounterDetail::Registry::Get();
+    std::lock_guard<std::mutex> lock(registry.mutex);
+    registry.retired = TraceCounters();
+    for (TraceCounters* counters : registry.live) *counters = TraceCounters();
+}
+
+#endif
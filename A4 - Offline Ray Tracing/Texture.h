@@ -0,0 +1,272 @@
+#ifndef TEXTURE_H
+#define TEXTURE_H
+
+#include "Framebuffer.h"
+#include "ImageIO.h"
+#include "RTWeekend.h"
+
+#include <algorithm>
+#include <atomic>
+#include <cstdint>
+#include <cstdio>
+#include <list>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+// Image textures that don't have to fit in memory. An ImageTexture reads its file once, builds
+// the mip pyramid and writes every level out as square tiles to a scratch file; after that only
+// the tiles lookups touch are in memory, held by TextureCache under a fixed byte budget.
+
+// One square block of a mip level, RGB floats row by row. Tiles at a level's right and bottom
+// edges are padded with texels nothing reads.
+struct TextureTile {
+    static constexpr int size = 32;
+    float texels[size * size * 3];
+};
+
+// The tiles of every ImageTexture, kept under a byte budget. Keys are spread over shards, each
+// with its own lock and least-recently-used list, and a shard over its share of the budget drops
+// tiles from the cold end. Tiles are handed out as shared_ptrs, so one evicted while a thread is
+// still reading it lives until that thread lets go.
+class TextureCache {
+public:
+    static TextureCache& Global() {
+        static TextureCache cache;
+        return cache;
+    }
+
+    // Applies from the next tile loaded on
+    void SetBudget(size_t bytes) { budget = bytes; }
+    size_t Budget() const { return budget; }
+
+    size_t BytesInUse() const { return bytesInUse; }
+    uint64_t Loads() const { return loads; }
+    uint64_t Evictions() const { return evictions; }
+
+    // The tile under 'key', calling 'load' to read it in if it isn't cached
+    template <typename Load>
+    shared_ptr<const TextureTile> Get(uint64_t key, Load&& load) {
+        Shard& shard = shards[(key * 0x9e3779b97f4a7c15ull) >> (64 - shardBits)];
+        {
+            std::lock_guard<std::mutex> lock(shard.mutex);
+            auto found = shard.entries.find(key);
+            if (found != shard.entries.end()) {
+                shard.recent.splice(shard.recent.begin(), shard.recent, found->second);
+                return found->second->second;
+            }
+        }
+
+        // Read without the lock so other lookups in the shard don't wait on the file
+        shared_ptr<const TextureTile> tile = load();
+        loads++;
+
+        std::lock_guard<std::mutex> lock(shard.mutex);
+        auto found = shard.entries.find(key);
+        if (found != shard.entries.end()) return found->second->second; // Another thread loaded it first
+
+        shard.recent.emplace_front(key, tile);
+        shard.entries.emplace(key, shard.recent.begin());
+        shard.bytes += sizeof(TextureTile);
+        bytesInUse += sizeof(TextureTile);
+
+        size_t shardBudget = std::max(budget / shardCount, sizeof(TextureTile));
+        while (shard.bytes > shardBudget) {
+            shard.entries.erase(shard.recent.back().first);
+            shard.recent.pop_back();
+            shard.bytes -= sizeof(TextureTile);
+            bytesInUse -= sizeof(TextureTile);
+            evictions++;
+        }
+        return tile;
+    }
+
+private:
+    static constexpr int shardBits = 4;
+    static constexpr size_t shardCount = size_t(1) << shardBits;
+
+    struct Shard {
+        std::mutex mutex;
+        std::list<std::pair<uint64_t, shared_ptr<const TextureTile>>> recent; // Most recently used first
+        std::unordered_map<uint64_t, std::list<std::pair<uint64_t, shared_ptr<const TextureTile>>>::iterator> entries;
+        size_t bytes = 0;
+    };
+
+    Shard shards[shardCount];
+    std::atomic<size_t> budget{ size_t(256) << 20 };
+    std::atomic<size_t> bytesInUse{ 0 };
+    std::atomic<uint64_t> loads{ 0 };
+    std::atomic<uint64_t> evictions{ 0 };
+};
+
+// A PPM or PFM image (see ReadImage) looked up through TextureCache. Levels halve down to a
+// single texel with a box filter; lookups are bilinear within a level and blend the two levels
+// around the footprint's size. Coordinates wrap, with v running up the image.
+//
+// Only loading holds whole levels in memory. Each thread also keeps its last few tiles, so the
+// tiles in memory can go past the cache budget by that many per rendering thread.
+class ImageTexture {
+public:
+    explicit ImageTexture(const std::string& path) {
+        Framebuffer image;
+        if (!ReadImage(path, image, error)) return;
+        file = std::tmpfile();
+        if (!file) {
+            error = "could not create a scratch file for " + path;
+            return;
+        }
+
+        uint32_t tileCount = 0;
+        while (true) {
+            Level level = { image.Width(), image.Height(), (image.Width() + TextureTile::size - 1) / TextureTile::size,
+                (image.Height() + TextureTile::size - 1) / TextureTile::size, tileCount };
+            WriteTiles(image, level);
+            tileCount += uint32_t(level.tilesX * level.tilesY);
+            levels.push_back(level);
+            if (image.Width() == 1 && image.Height() == 1) break;
+            image = Downsample(image);
+        }
+
+        if (std::fflush(file) != 0 || std::ferror(file)) {
+            error = "could not write the tiles of " + path;
+            levels.clear();
+        }
+    }
+
+    ~ImageTexture() {
+        if (file) std::fclose(file);
+    }
+
+    ImageTexture(const ImageTexture&) = delete;
+    ImageTexture& operator=(const ImageTexture&) = delete;
+
+    bool Valid() const { return !levels.empty(); }
+    const std::string& Error() const { return error; }
+
+    int Width() const { return levels.empty() ? 0 : levels[0].width; }
+    int Height() const { return levels.empty() ? 0 : levels[0].height; }
+    int LevelCount() const { return int(levels.size()); }
+
+    // The color at (u, v) filtered over a footprint 'width' texture units across, where the
+    // whole image is one unit
+    Color Value(double u, double v, double width) const {
+        if (levels.empty()) return Color(0, 0, 0);
+        double lod = std::log2(std::fmax(width * std::max(Width(), Height()), 1e-12));
+        lod = std::clamp(lod, 0.0, double(levels.size() - 1));
+
+        int level = int(lod);
+        double blend = lod - level;
+        Color color = Bilinear(level, u, v);
+        if (blend > 0) color = (1 - blend) * color + blend * Bilinear(level + 1, u, v);
+        return color;
+    }
+
+private:
+    struct Level {
+        int width, height;
+        int tilesX, tilesY;
+        uint32_t firstTile; // Tiles are stored level by level, row by row
+    };
+
+    static constexpr uint32_t recentTiles = 8;
+
+    struct RecentTile {
+        uint64_t key = UINT64_MAX;
+        shared_ptr<const TextureTile> tile;
+    };
+
+    inline static std::atomic<uint32_t> nextId{ 0 };
+
+    uint32_t id = nextId++; // Never reused, so a new texture can't find an old one's tiles in the cache
+    std::vector<Level> levels;
+    std::string error;
+    std::FILE* file = nullptr;
+    mutable std::mutex fileMutex;
+
+    Color Bilinear(int level, double u, double v) const {
+        const Level& size = levels[size_t(level)];
+        double x = (u - std::floor(u)) * size.width - 0.5;
+        double y = (1 - (v - std::floor(v))) * size.height - 0.5;
+        double xFloor = std::floor(x), yFloor = std::floor(y);
+        double fx = x - xFloor, fy = y - yFloor;
+
+        auto wrap = [](int i, int count) {
+            i %= count;
+            return i < 0 ? i + count : i;
+        };
+        int x0 = wrap(int(xFloor), size.width), x1 = wrap(int(xFloor) + 1, size.width);
+        int y0 = wrap(int(yFloor), size.height), y1 = wrap(int(yFloor) + 1, size.height);
+
+        return (1 - fy) * ((1 - fx) * Texel(level, x0, y0) + fx * Texel(level, x1, y0))
+            + fy * ((1 - fx) * Texel(level, x0, y1) + fx * Texel(level, x1, y1));
+    }
+
+    Color Texel(int level, int x, int y) const {
+        const Level& size = levels[size_t(level)];
+        uint32_t index = size.firstTile + uint32_t((y / TextureTile::size) * size.tilesX + x / TextureTile::size);
+        const float* texel = &Tile(index).texels[((y % TextureTile::size) * TextureTile::size + x % TextureTile::size) * 3];
+        return Color(texel[0], texel[1], texel[2]);
+    }
+
+    // Neighbouring texels nearly always share a tile, so each thread checks the tiles it used
+    // last before going to the shared cache and its locks
+    const TextureTile& Tile(uint32_t index) const {
+        thread_local RecentTile recent[recentTiles];
+        uint64_t key = uint64_t(id) << 32 | index;
+        RecentTile& slot = recent[(index + id * 5) % recentTiles];
+        if (slot.key != key) {
+            slot.tile = TextureCache::Global().Get(key, [&] { return LoadTile(index); });
+            slot.key = key;
+        }
+        return *slot.tile;
+    }
+
+    shared_ptr<const TextureTile> LoadTile(uint32_t index) const {
+        auto tile = make_shared<TextureTile>();
+        std::lock_guard<std::mutex> lock(fileMutex);
+        if (Seek(uint64_t(index) * sizeof(TextureTile))) std::fread(tile->texels, sizeof(TextureTile), 1, file);
+        return tile;
+    }
+
+    bool Seek(uint64_t offset) const {
+#if defined(_WIN32)
+        return _fseeki64(file, int64_t(offset), SEEK_SET) == 0;
+#else
+        return fseeko(file, off_t(offset), SEEK_SET) == 0;
+#endif
+    }
+
+    void WriteTiles(const Framebuffer& image, const Level& level) {
+        TextureTile tile;
+        for (int tileY = 0; tileY < level.tilesY; tileY++) {
+            for (int tileX = 0; tileX < level.tilesX; tileX++) {
+                std::fill(std::begin(tile.texels), std::end(tile.texels), 0.0f);
+                int x0 = tileX * TextureTile::size, y0 = tileY * TextureTile::size;
+                int columns = std::min(TextureTile::size, level.width - x0);
+                for (int y = 0; y < TextureTile::size && y0 + y < level.height; y++) {
+                    const float* row = image.Data() + (size_t(y0 + y) * level.width + x0) * 3;
+                    std::copy(row, row + columns * 3, &tile.texels[y * TextureTile::size * 3]);
+                }
+                std::fwrite(tile.texels, sizeof(TextureTile), 1, file);
+            }
+        }
+    }
+
+    // Averages 2x2 blocks; an odd last row or column is averaged with itself
+    static Framebuffer Downsample(const Framebuffer& image) {
+        Framebuffer half(std::max(1, (image.Width() + 1) / 2), std::max(1, (image.Height() + 1) / 2));
+        for (int y = 0; y < half.Height(); y++) {
+            int sourceY0 = std::min(2 * y, image.Height() - 1), sourceY1 = std::min(2 * y + 1, image.Height() - 1);
+            for (int x = 0; x < half.Width(); x++) {
+                int sourceX0 = std::min(2 * x, image.Width() - 1), sourceX1 = std::min(2 * x + 1, image.Width() - 1);
+                half.Set(x, y, 0.25 * (image.Get(sourceX0, sourceY0) + image.Get(sourceX1, sourceY0)
+                    + image.Get(sourceX0, sourceY1) + image.Get(sourceX1, sourceY1)));
+            }
+        }
+        return half;
+    }
+};
+
+#endif
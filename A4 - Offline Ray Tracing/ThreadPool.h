@@ -0,0 +1,161 @@
+#ifndef THREAD_POOL_H
+#define THREAD_POOL_H
+
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// Counts the outstanding tasks of one batch so a caller can wait on just that batch.
+class TaskGroup {
+public:
+    bool Done() const { return pending.load(std::memory_order_acquire) == 0; }
+
+private:
+    friend class ThreadPool;
+    std::atomic<int> pending{ 0 };
+};
+
+// Work-stealing pool. Every worker owns a deque: it pops its own work from the back (newest first,
+// so nested tasks stay cache-warm) and idle workers steal from the front of other deques.
+class ThreadPool {
+public:
+    explicit ThreadPool(int threadCount = 0) {
+        if (threadCount <= 0)
+            threadCount = std::max(1, int(std::thread::hardware_concurrency()));
+
+        for (int i = 0; i < threadCount; i++)
+            queues.push_back(std::make_unique<WorkQueue>());
+        for (int i = 0; i < threadCount; i++)
+            workers.emplace_back([this, i] { WorkerLoop(i); });
+    }
+
+    ~ThreadPool() {
+        {
+            std::lock_guard<std::mutex> lock(sleepMutex);
+            stopping = true;
+        }
+        sleepCondition.notify_all();
+        for (std::thread& worker : workers) worker.join();
+    }
+
+    ThreadPool(const ThreadPool&) = delete;
+    ThreadPool& operator=(const ThreadPool&) = delete;
+
+    int ThreadCount() const { return int(workers.size()); }
+
+    void Submit(TaskGroup& group, std::function<void()> task) {
+        group.pending.fetch_add(1, std::memory_order_relaxed);
+
+        // Work spawned by a worker stays on its own deque; outside work is dealt round-robin
+        int index = currentPool == this ? currentWorker : int(nextQueue++ % queues.size());
+        {
+            std::lock_guard<std::mutex> lock(queues[index]->mutex);
+            queues[index]->tasks.push_back({ std::move(task), &group });
+        }
+        {
+            std::lock_guard<std::mutex> lock(sleepMutex);
+            queuedCount++;
+        }
+        sleepCondition.notify_one();
+    }
+
+    // Blocks until every task in the group has finished. The waiting thread runs queued tasks
+    // in the meantime, so tasks may themselves submit and wait on nested groups.
+    void Wait(TaskGroup& group) {
+        int home = currentPool == this ? currentWorker : 0;
+        while (!group.Done()) {
+            Task task;
+            if ((currentPool == this && TryPop(home, task)) || TrySteal(home, task))
+                Run(task);
+            else
+                std::this_thread::yield();
+        }
+    }
+
+    // Splits [0, count) into one task per index and waits for all of them.
+    void ParallelFor(int count, const std::function<void(int)>& body) {
+        TaskGroup group;
+        for (int i = 0; i < count; i++)
+            Submit(group, [&body, i] { body(i); });
+        Wait(group);
+    }
+
+private:
+    struct Task {
+        std::function<void()> work;
+        TaskGroup* group = nullptr;
+    };
+
+    struct WorkQueue {
+        std::mutex mutex;
+        std::deque<Task> tasks;
+    };
+
+    std::vector<std::unique_ptr<WorkQueue>> queues;
+    std::vector<std::thread> workers;
+    std::atomic<unsigned> nextQueue{ 0 };
+
+    std::mutex sleepMutex;
+    std::condition_variable sleepCondition;
+    int queuedCount = 0;
+    bool stopping = false;
+
+    static inline thread_local ThreadPool* currentPool = nullptr;
+    static inline thread_local int currentWorker = -1;
+
+    bool TryPop(int index, Task& task) {
+        WorkQueue& queue = *queues[index];
+        std::lock_guard<std::mutex> lock(queue.mutex);
+        if (queue.tasks.empty()) return false;
+        task = std::move(queue.tasks.back());
+        queue.tasks.pop_back();
+        return true;
+    }
+
+    bool TrySteal(int thief, Task& task) {
+        int count = int(queues.size());
+        for (int offset = 1; offset <= count; offset++) {
+            WorkQueue& queue = *queues[(thief + offset) % count];
+            std::lock_guard<std::mutex> lock(queue.mutex);
+            if (queue.tasks.empty()) continue;
+            task = std::move(queue.tasks.front());
+            queue.tasks.pop_front();
+            return true;
+        }
+        return false;
+    }
+
+    void Run(Task& task) {
+        {
+            std::lock_guard<std::mutex> lock(sleepMutex);
+            queuedCount--;
+        }
+        task.work();
+        task.group->pending.fetch_sub(1, std::memory_order_release);
+    }
+
+    void WorkerLoop(int index) {
+        currentPool = this;
+        currentWorker = index;
+
+        while (true) {
+            Task task;
+            if (TryPop(index, task) || TrySteal(index, task)) {
+                Run(task);
+                continue;
+            }
+
+            std::unique_lock<std::mutex> lock(sleepMutex);
+            sleepCondition.wait(lock, [this] { return stopping || queuedCount > 0; });
+            if (stopping) return;
+        }
+    }
+};
+
+#endif
@@ -0,0 +1,151 @@
+#ifndef TRANSFORM_H
+#define TRANSFORM_H
+
+#include "AABB.h"
+#include "RTWeekend.h"
+
+#include <cmath>
+
+// An affine transform and its inverse, each kept as the top three rows of a 4x4 matrix that
+// multiplies column vectors. Built like Transform::SetWorldMatrices in the real-time projects:
+// scale, then rotation by (pitch, yaw, roll) in radians as XMMatrixRotationRollPitchYaw
+// applies it (roll about Z, pitch about X, yaw about Y), then translation.
+class Transform {
+public:
+    Transform() : matrix(Identity()), inverse(Identity()) {}
+
+    Transform(const Point3& position, const Vector3& rotation = Vector3(0, 0, 0), const Vector3& scale = Vector3(1, 1, 1)) {
+        double cp = std::cos(rotation.x()), sp = std::sin(rotation.x());
+        double cy = std::cos(rotation.y()), sy = std::sin(rotation.y());
+        double cr = std::cos(rotation.z()), sr = std::sin(rotation.z());
+
+        // Yaw * Pitch * Roll, so roll is applied first
+        Matrix rollPitchYaw = { {
+            { cy * cr + sy * sp * sr, -cy * sr + sy * sp * cr, sy * cp, 0 },
+            { cp * sr, cp * cr, -sp, 0 },
+            { -sy * cr + cy * sp * sr, sy * sr + cy * sp * cr, cy * cp, 0 },
+        } };
+
+        for (int row = 0; row < 3; row++) {
+            for (int column = 0; column < 3; column++)
+                matrix.m[row][column] = rollPitchYaw.m[row][column] * scale[column];
+            matrix.m[row][3] = position[row];
+        }
+        inverse = Invert(matrix);
+    }
+
+    // This transform applied after 'first'
+    Transform operator*(const Transform& first) const {
+        Transform combined;
+        combined.matrix = Multiply(matrix, first.matrix);
+        combined.inverse = Multiply(first.inverse, inverse);
+        return combined;
+    }
+
+    Transform Inverse() const {
+        Transform inverted;
+        inverted.matrix = inverse;
+        inverted.inverse = matrix;
+        return inverted;
+    }
+
+    Point3 ApplyToPoint(const Point3& point) const { return ApplyPoint(matrix, point); }
+    Vector3 ApplyToVector(const Vector3& vector) const { return ApplyVector(matrix, vector); }
+    Point3 InverseToPoint(const Point3& point) const { return ApplyPoint(inverse, point); }
+    Vector3 InverseToVector(const Vector3& vector) const { return ApplyVector(inverse, vector); }
+
+    // Normals take the inverse transpose so they stay perpendicular under non-uniform scale.
+    // The result isn't normalized.
+    Vector3 ApplyToNormal(const Vector3& normal) const {
+        return Vector3(
+            inverse.m[0][0] * normal.x() + inverse.m[1][0] * normal.y() + inverse.m[2][0] * normal.z(),
+            inverse.m[0][1] * normal.x() + inverse.m[1][1] * normal.y() + inverse.m[2][1] * normal.z(),
+            inverse.m[0][2] * normal.x() + inverse.m[1][2] * normal.y() + inverse.m[2][2] * normal.z());
+    }
+
+    // Tight box around the transformed box (Arvo, Graphics Gems 1990)
+    AABB ApplyToBox(const AABB& box) const {
+        if (box.IsEmpty()) return box;
+        Interval axes[3];
+        for (int row = 0; row < 3; row++) {
+            double low = matrix.m[row][3], high = matrix.m[row][3];
+            for (int column = 0; column < 3; column++) {
+                const Interval& extent = box.AxisInterval(column);
+                double a = matrix.m[row][column] * extent.min;
+                double b = matrix.m[row][column] * extent.max;
+                low += std::fmin(a, b);
+                high += std::fmax(a, b);
+            }
+            axes[row] = Interval(low, high);
+        }
+        return AABB(axes[0], axes[1], axes[2]);
+    }
+
+private:
+    struct Matrix {
+        double m[3][4];
+    };
+
+    Matrix matrix;
+    Matrix inverse;
+
+    static Matrix Identity() {
+        return { {
+            { 1, 0, 0, 0 },
+            { 0, 1, 0, 0 },
+            { 0, 0, 1, 0 },
+        } };
+    }
+
+    static Point3 ApplyPoint(const Matrix& a, const Point3& p) {
+        return Point3(
+            a.m[0][0] * p.x() + a.m[0][1] * p.y() + a.m[0][2] * p.z() + a.m[0][3],
+            a.m[1][0] * p.x() + a.m[1][1] * p.y() + a.m[1][2] * p.z() + a.m[1][3],
+            a.m[2][0] * p.x() + a.m[2][1] * p.y() + a.m[2][2] * p.z() + a.m[2][3]);
+    }
+
+    static Vector3 ApplyVector(const Matrix& a, const Vector3& v) {
+        return Vector3(
+            a.m[0][0] * v.x() + a.m[0][1] * v.y() + a.m[0][2] * v.z(),
+            a.m[1][0] * v.x() + a.m[1][1] * v.y() + a.m[1][2] * v.z(),
+            a.m[2][0] * v.x() + a.m[2][1] * v.y() + a.m[2][2] * v.z());
+    }
+
+    static Matrix Multiply(const Matrix& a, const Matrix& b) {
+        Matrix result;
+        for (int row = 0; row < 3; row++) {
+            for (int column = 0; column < 4; column++) {
+                result.m[row][column] = a.m[row][0] * b.m[0][column] + a.m[row][1] * b.m[1][column] + a.m[row][2] * b.m[2][column];
+            }
+            result.m[row][3] += a.m[row][3];
+        }
+        return result;
+    }
+
+    // Inverse of the linear part by cofactors, then the translation undone through it
+    static Matrix Invert(const Matrix& a) {
+        const double (&m)[3][4] = a.m;
+        double c00 = m[1][1] * m[2][2] - m[1][2] * m[2][1];
+        double c01 = m[1][2] * m[2][0] - m[1][0] * m[2][2];
+        double c02 = m[1][0] * m[2][1] - m[1][1] * m[2][0];
+        double determinant = m[0][0] * c00 + m[0][1] * c01 + m[0][2] * c02;
+        double scale = 1 / determinant;
+
+        Matrix result;
+        result.m[0][0] = c00 * scale;
+        result.m[0][1] = (m[0][2] * m[2][1] - m[0][1] * m[2][2]) * scale;
+        result.m[0][2] = (m[0][1] * m[1][2] - m[0][2] * m[1][1]) * scale;
+        result.m[1][0] = c01 * scale;
+        result.m[1][1] = (m[0][0] * m[2][2] - m[0][2] * m[2][0]) * scale;
+        result.m[1][2] = (m[0][2] * m[1][0] - m[0][0] * m[1][2]) * scale;
+        result.m[2][0] = c02 * scale;
+        result.m[2][1] = (m[0][1] * m[2][0] - m[0][0] * m[2][1]) * scale;
+        result.m[2][2] = (m[0][0] * m[1][1] - m[0][1] * m[1][0]) * scale;
+
+        for (int row = 0; row < 3; row++)
+            result.m[row][3] = -(result.m[row][0] * m[0][3] + result.m[row][1] * m[1][3] + result.m[row][2] * m[2][3]);
+        return result;
+    }
+};
+
+#endif
@@ -0,0 +1,362 @@
+#ifndef TRIANGLE_MESH_H
+#define TRIANGLE_MESH_H
+
+#include "BVH.h"
+#include "Hittable.h"
+#include "LightList.h"
+#include "MaterialTable.h"
+
+#include <cmath>
+#include <cstdint>
+#include <cstdlib>
+#include <fstream>
+#include <string>
+#include <utility>
+#include <vector>
+
+// An indexed triangle mesh with its own BVH, so a whole model is a single Hittable in the scene.
+// All triangles share one material.
+class TriangleMesh : public Hittable {
+public:
+    struct Triangle {
+        uint32_t positions[3];
+        uint32_t normals[3]; // noNormal when the file has none; the face normal is used instead
+    };
+
+    static constexpr uint32_t noNormal = UINT32_MAX;
+    static constexpr uint32_t noTexcoord = UINT32_MAX;
+
+    // Loads an OBJ the same way Mesh::Mesh(const wchar_t*) does for the real-time projects:
+    // Z is negated on positions and normals and the winding is flipped, converting the file's
+    // right-handed space to the left-handed one the scenes are authored in. The model is then
+    // scaled and moved to 'position'. Leaves the mesh empty if the file can't be opened or a face
+    // refers to a vertex that doesn't exist, with Error() naming the file and line.
+    TriangleMesh(const std::string& filePath, shared_ptr<Material> material, const Point3& position = Point3(0, 0, 0),
+        double scale = 1, ThreadPool* pool = nullptr)
+        : materialId(MaterialTable::Global().Add(material)) {
+        LoadOBJ(filePath, position, scale);
+        BuildBVH(pool);
+    }
+
+    TriangleMesh(std::vector<Point3> positions, std::vector<Vector3> normals, std::vector<Triangle> triangles,
+        shared_ptr<Material> material, ThreadPool* pool = nullptr)
+        : positions(std::move(positions)), normals(std::move(normals)), triangles(std::move(triangles)), materialId(MaterialTable::Global().Add(material)) {
+        BuildBVH(pool);
+    }
+
+    size_t TriangleCount() const { return triangles.size(); }
+    const std::string& Error() const { return error; }
+
+    bool Hit(const Ray& ray, Interval rayT, HitRecord& record) const override {
+        TRACE_COUNT(hitCalls);
+        RayPrecomputation shear(ray);
+        uint32_t closestTriangle = 0;
+        double closestT = 0, closestU = 0, closestV = 0;
+
+        bool hit = TraverseBVH(nodes, ray, rayT, [&](uint32_t first, uint32_t count, Interval& leafT) {
+            TRACE_ADD(primitiveTests, count);
+            bool hitAnything = false;
+            for (uint32_t i = first; i < first + count; i++) {
+                double t, u, v;
+                if (Intersect(triangles[i], shear, leafT, t, u, v)) {
+                    hitAnything = true;
+                    leafT.max = t;
+                    closestTriangle = i;
+                    closestT = t;
+                    closestU = u;
+                    closestV = v;
+                }
+            }
+            return hitAnything;
+        });
+        if (!hit) return false;
+
+        record.t = closestT;
+        record.object = this;
+        record.primitiveId = closestTriangle;
+        record.u = closestU;
+        record.v = closestV;
+        return true;
+    }
+
+    void ComputeSurface(const Ray& ray, HitRecord& record) const override {
+        const Triangle& triangle = triangles[record.primitiveId];
+        const Point3& p0 = positions[triangle.positions[0]];
+        const Point3& p1 = positions[triangle.positions[1]];
+        const Point3& p2 = positions[triangle.positions[2]];
+        double w = 1 - record.u - record.v;
+
+        record.point = ray.At(record.t);
+        record.materialId = materialId;
+
+        // The face normal decides which side was hit; the interpolated normal is only for shading
+        Vector3 faceNormal = UnitVector(Cross(p1 - p0, p2 - p0));
+        record.SetFaceNormal(ray, faceNormal);
+        if (triangle.normals[0] != noNormal) {
+            Vector3 shadingNormal = UnitVector(w * normals[triangle.normals[0]]
+                + record.u * normals[triangle.normals[1]]
+                + record.v * normals[triangle.normals[2]]);
+            record.normal = record.frontFace ? shadingNormal : -shadingNormal;
+        }
+    }
+
+    // The file's texture coordinates where it has them; otherwise each triangle maps to the
+    // corner of the texture below the diagonal, u and v being its barycentrics
+    void ComputeTextureCoordinates(const Ray& ray, HitRecord& record) const override {
+        const Triangle& triangle = triangles[record.primitiveId];
+        const Point3& p0 = positions[triangle.positions[0]];
+        double worldArea = Cross(positions[triangle.positions[1]] - p0, positions[triangle.positions[2]] - p0).Length();
+
+        const uint32_t* corners = cornerTexcoords.empty() ? nullptr : &cornerTexcoords[size_t(record.primitiveId) * 3];
+        if (!corners || corners[0] == noTexcoord) {
+            record.textureU = record.u;
+            record.textureV = record.v;
+            record.textureScale = worldArea > 0 ? std::sqrt(1 / worldArea) : 0;
+            return;
+        }
+
+        const TextureCoordinate& t0 = texcoords[corners[0]];
+        const TextureCoordinate& t1 = texcoords[corners[1]];
+        const TextureCoordinate& t2 = texcoords[corners[2]];
+        double w = 1 - record.u - record.v;
+        record.textureU = w * t0.u + record.u * t1.u + record.v * t2.u;
+        record.textureV = w * t0.v + record.u * t1.v + record.v * t2.v;
+
+        // Square root of how much the mapping scales areas
+        double textureArea = std::fabs((t1.u - t0.u) * (t2.v - t0.v) - (t2.u - t0.u) * (t1.v - t0.v));
+        record.textureScale = worldArea > 0 ? std::sqrt(textureArea / worldArea) : 0;
+    }
+
+    void CollectLights(LightList& lights) const override {
+        if (!lights.IsEmissive(materialId)) return;
+        for (uint32_t i = 0; i < triangles.size(); i++) {
+            const Triangle& triangle = triangles[i];
+            lights.AddTriangle(positions[triangle.positions[0]], positions[triangle.positions[1]],
+                positions[triangle.positions[2]], materialId, this, i);
+        }
+    }
+
+    AABB BoundingBox() const override {
+        return nodes.empty() ? AABB() : nodes[0].bounds;
+    }
+
+private:
+    struct TextureCoordinate {
+        double u, v;
+    };
+
+    std::vector<Point3> positions;
+    std::vector<Vector3> normals;
+    std::vector<Triangle> triangles;
+    std::vector<TextureCoordinate> texcoords;
+    std::vector<uint32_t> cornerTexcoords; // Three per triangle, in 'triangles' order; empty when no face has any
+    std::vector<BVHNode> nodes;
+    uint32_t materialId;
+    std::string error;
+
+    void LoadOBJ(const std::string& filePath, const Point3& position, double scale) {
+        std::ifstream obj(filePath);
+        if (!obj.is_open()) {
+            error = "could not open " + filePath;
+            return;
+        }
+
+        std::string line;
+        size_t lineNumber = 0;
+        bool anyTexcoords = false;
+        std::vector<uint32_t> facePositions, faceTexcoords, faceNormals;
+        while (std::getline(obj, line)) {
+            lineNumber++;
+            const char* cursor = line.c_str();
+            if (cursor[0] == 'v' && cursor[1] == 't') {
+                char* end;
+                double u = std::strtod(cursor + 2, &end);
+                texcoords.push_back({ u, std::strtod(end, &end) });
+            }
+            else if (cursor[0] == 'v' && cursor[1] == 'n') {
+                Vector3 normal = ReadVector(cursor + 2);
+                normals.push_back(UnitVector(Vector3(normal.x(), normal.y(), -normal.z())));
+            }
+            else if (cursor[0] == 'v' && cursor[1] == ' ') {
+                Vector3 point = ReadVector(cursor + 1);
+                positions.push_back(position + scale * Vector3(point.x(), point.y(), -point.z()));
+            }
+            else if (cursor[0] == 'f' && cursor[1] == ' ') {
+                std::string problem;
+                if (!ParseFace(cursor + 1, facePositions, faceTexcoords, faceNormals, problem)) {
+                    error = filePath + ":" + std::to_string(lineNumber) + ": " + problem;
+                    positions.clear();
+                    normals.clear();
+                    triangles.clear();
+                    texcoords.clear();
+                    cornerTexcoords.clear();
+                    return;
+                }
+                bool hasNormals = faceNormals.size() == facePositions.size();
+                bool hasTexcoords = faceTexcoords.size() == facePositions.size();
+                anyTexcoords = anyTexcoords || hasTexcoords;
+
+                // Fan out polygons, flipping the winding to match the Z flip
+                for (size_t i = 2; i < facePositions.size(); i++) {
+                    Triangle triangle;
+                    size_t corners[3] = { 0, i, i - 1 };
+                    for (int c = 0; c < 3; c++) {
+                        triangle.positions[c] = facePositions[corners[c]];
+                        triangle.normals[c] = hasNormals ? faceNormals[corners[c]] : noNormal;
+                        cornerTexcoords.push_back(hasTexcoords ? faceTexcoords[corners[c]] : noTexcoord);
+                    }
+                    triangles.push_back(triangle);
+                }
+            }
+        }
+        // Kept for every face so they stay in step with the triangles, and dropped if none had any
+        if (!anyTexcoords) cornerTexcoords.clear();
+    }
+
+    static Vector3 ReadVector(const char* cursor) {
+        char* end;
+        double x = std::strtod(cursor, &end);
+        double y = std::strtod(end, &end);
+        double z = std::strtod(end, &end);
+        return Vector3(x, y, z);
+    }
+
+    // Reads "p", "p/t", "p//n" or "p/t/n" corners, converting 1-based (or negative, relative)
+    // indices to 0-based ones. Returns false with 'problem' set if an index is 0 or refers to an
+    // element not yet defined.
+    bool ParseFace(const char* cursor, std::vector<uint32_t>& facePositions, std::vector<uint32_t>& faceTexcoords,
+        std::vector<uint32_t>& faceNormals, std::string& problem) const {
+        facePositions.clear();
+        faceTexcoords.clear();
+        faceNormals.clear();
+
+        auto resolve = [&](long index, size_t count, const char* kind, std::vector<uint32_t>& resolved) {
+            long zeroBased = index < 0 ? long(count) + index : index - 1;
+            if (index == 0 || zeroBased < 0 || size_t(zeroBased) >= count) {
+                problem = std::string(kind) + " index " + std::to_string(index) + " is out of range, there are " + std::to_string(count);
+                return false;
+            }
+            resolved.push_back(uint32_t(zeroBased));
+            return true;
+        };
+
+        while (true) {
+            char* end;
+            long positionIndex = std::strtol(cursor, &end, 10);
+            if (end == cursor) break;
+            cursor = end;
+            if (!resolve(positionIndex, positions.size(), "position", facePositions)) return false;
+
+            if (*cursor == '/') {
+                cursor++;
+                long texcoordIndex = std::strtol(cursor, &end, 10);
+                if (end != cursor && !resolve(texcoordIndex, texcoords.size(), "texture coordinate", faceTexcoords)) return false;
+                cursor = end;
+                if (*cursor == '/') {
+                    cursor++;
+                    long normalIndex = std::strtol(cursor, &end, 10);
+                    if (end != cursor && !resolve(normalIndex, normals.size(), "normal", faceNormals)) return false;
+                    cursor = end;
+                }
+            }
+        }
+        return true;
+    }
+
+    void BuildBVH(ThreadPool* pool) {
+        std::vector<AABB> bounds;
+        bounds.reserve(triangles.size());
+        for (const Triangle& triangle : triangles) {
+            const Point3& p0 = positions[triangle.positions[0]];
+            AABB box(AABB(p0, positions[triangle.positions[1]]), AABB(p0, positions[triangle.positions[2]]));
+            // Axis-aligned triangles have flat boxes, which the slab test can miss at grazing angles
+            bounds.push_back(AABB(box.x.Expand(1e-9), box.y.Expand(1e-9), box.z.Expand(1e-9)));
+        }
+
+        std::vector<uint32_t> order;
+        nodes = BVHBuilder::Build(bounds, order, pool);
+
+        std::vector<Triangle> ordered;
+        ordered.reserve(order.size());
+        for (uint32_t index : order)
+            ordered.push_back(triangles[index]);
+        triangles = std::move(ordered);
+
+        if (!cornerTexcoords.empty()) {
+            std::vector<uint32_t> orderedTexcoords;
+            orderedTexcoords.reserve(cornerTexcoords.size());
+            for (uint32_t index : order)
+                orderedTexcoords.insert(orderedTexcoords.end(), &cornerTexcoords[size_t(index) * 3], &cornerTexcoords[size_t(index) * 3] + 3);
+            cornerTexcoords = std::move(orderedTexcoords);
+        }
+    }
+
+    // Per-ray setup for the watertight test of Woop, Benthin and Wald (JCGT 2013): the ray is
+    // turned into +Z by permuting axes and shearing, so every triangle is tested in the same
+    // 2D space and edges shared by two triangles are evaluated identically for both.
+    struct RayPrecomputation {
+        int kx, ky, kz;
+        double shearX, shearY, shearZ;
+        Point3 origin;
+
+        RayPrecomputation(const Ray& ray) : origin(ray.Origin()) {
+            const Vector3& direction = ray.Direction();
+            kz = 0;
+            if (std::fabs(direction.y()) > std::fabs(direction[kz])) kz = 1;
+            if (std::fabs(direction.z()) > std::fabs(direction[kz])) kz = 2;
+            kx = (kz + 1) % 3;
+            ky = (kx + 1) % 3;
+            // Keep the winding of the sheared triangle independent of the ray's direction
+            if (direction[kz] < 0) std::swap(kx, ky);
+
+            shearX = direction[kx] / direction[kz];
+            shearY = direction[ky] / direction[kz];
+            shearZ = 1 / direction[kz];
+        }
+    };
+
+    // Twice the signed area of (origin, p, q). Two triangles sharing an edge must get exactly
+    // opposite values for it, but with FMA contraction p x q and -(q x p) round differently, so
+    // the endpoints are always multiplied in the same order and the sign fixed up afterwards.
+    static double EdgeFunction(double px, double py, double qx, double qy) {
+        if (px < qx || (px == qx && py < qy)) return px * qy - py * qx;
+        return -(qx * py - qy * px);
+    }
+
+    bool Intersect(const Triangle& triangle, const RayPrecomputation& shear, const Interval& rayT, double& t, double& u, double& v) const {
+        Vector3 a = positions[triangle.positions[0]] - shear.origin;
+        Vector3 b = positions[triangle.positions[1]] - shear.origin;
+        Vector3 c = positions[triangle.positions[2]] - shear.origin;
+
+        double ax = a[shear.kx] - shear.shearX * a[shear.kz];
+        double ay = a[shear.ky] - shear.shearY * a[shear.kz];
+        double bx = b[shear.kx] - shear.shearX * b[shear.kz];
+        double by = b[shear.ky] - shear.shearY * b[shear.kz];
+        double cx = c[shear.kx] - shear.shearX * c[shear.kz];
+        double cy = c[shear.ky] - shear.shearY * c[shear.kz];
+
+        // Scaled barycentrics; the ray hits only if all three share a sign
+        double edgeA = EdgeFunction(bx, by, cx, cy);
+        double edgeB = EdgeFunction(cx, cy, ax, ay);
+        double edgeC = EdgeFunction(ax, ay, bx, by);
+        if ((edgeA < 0 || edgeB < 0 || edgeC < 0) && (edgeA > 0 || edgeB > 0 || edgeC > 0)) return false;
+
+        double determinant = edgeA + edgeB + edgeC;
+        if (determinant == 0) return false;
+
+        double az = shear.shearZ * a[shear.kz];
+        double bz = shear.shearZ * b[shear.kz];
+        double cz = shear.shearZ * c[shear.kz];
+        double scaledT = edgeA * az + edgeB * bz + edgeC * cz;
+
+        double inverseDeterminant = 1 / determinant;
+        t = scaledT * inverseDeterminant;
+        if (t <= rayT.min || t >= rayT.max) return false;
+
+        u = edgeB * inverseDeterminant;
+        v = edgeC * inverseDeterminant;
+        return true;
+    }
+};
+
+#endif
@@ -3,128 +3,158 @@
 
 #include "RTWeekend.h"
 
-class Vector3 {
+#include <type_traits>
+
+// Scalar type is a template parameter so hot intersection code can work in float while the
+// rest of the tracer stays in double. Vector3 (and Point3, Color) remain the double versions.
+template <typename T>
+class Vector3T {
 public:
-    double points[3];
+    T points[3];
+
+    Vector3T() : points{ 0,0,0 } {}
+    Vector3T(T x, T y, T z) : points{ x, y, z} {}
 
-    Vector3() : points{ 0,0,0 } {}
-    Vector3(double x, double y, double z) : points{ x, y, z} {}
+    // Precision changes are always spelled out
+    template <typename U>
+    explicit Vector3T(const Vector3T<U>& other) : points{ T(other.points[0]), T(other.points[1]), T(other.points[2]) } {}
 
-    double x() const { return points[0]; }
-    double y() const { return points[1]; }
-    double z() const { return points[2]; }
+    T x() const { return points[0]; }
+    T y() const { return points[1]; }
+    T z() const { return points[2]; }
 
-    Vector3 operator-() const { return Vector3(-points[0], -points[1], -points[2]); }
-    double operator[](int index) const { return points[index]; }
-    double& operator[](int index) { return points[index]; }
+    Vector3T operator-() const { return Vector3T(-points[0], -points[1], -points[2]); }
+    T operator[](int index) const { return points[index]; }
+    T& operator[](int index) { return points[index]; }
 
-    Vector3& operator+=(const Vector3& vector) {
+    Vector3T& operator+=(const Vector3T& vector) {
         points[0] += vector.points[0];
         points[1] += vector.points[1];
         points[2] += vector.points[2];
         return *this;
     }
 
-    Vector3& operator*=(double scalar) {
+    Vector3T& operator*=(T scalar) {
         points[0] *= scalar;
         points[1] *= scalar;
         points[2] *= scalar;
         return *this;
     }
 
-    Vector3& operator/=(double divisor) {
+    Vector3T& operator/=(T divisor) {
         return *this *= 1 / divisor;
     }
 
-    double Length() const {
+    T Length() const {
         return std::sqrt(LengthSquared());
     }
 
-    double LengthSquared() const {
+    T LengthSquared() const {
         return points[0] * points[0] + points[1] * points[1] + points[2] * points[2];
     }
 
     bool NearZero() const {
-        double s = 1e-8;
-        return fabs(points[0]) < s && fabs(points[1]) < s && fabs(points[2]) < s;
+        T s = T(1e-8);
+        return std::fabs(points[0]) < s && std::fabs(points[1]) < s && std::fabs(points[2]) < s;
     }
 
-    static Vector3 Random() {
-        return Vector3(RandomDouble(), RandomDouble(), RandomDouble());
+    static Vector3T Random(Rng& rng) {
+        T x = T(RandomDouble(rng));
+        T y = T(RandomDouble(rng));
+        return Vector3T(x, y, T(RandomDouble(rng)));
     }
 
-    static Vector3 Random(double min, double max) {
-        return Vector3(RandomDouble(min, max), RandomDouble(min, max), RandomDouble(min, max));
+    static Vector3T Random(Rng& rng, double min, double max) {
+        T x = T(RandomDouble(rng, min, max));
+        T y = T(RandomDouble(rng, min, max));
+        return Vector3T(x, y, T(RandomDouble(rng, min, max)));
     }
 };
 
+using Vector3f = Vector3T<float>;
+using Vector3d = Vector3T<double>;
+using Vector3 = Vector3d;
+
 // point3 is just an alias for Vector3, but useful for geometric clarity in the code.
 using Point3 = Vector3;
+using Point3f = Vector3f;
 
 
 // Vector Utility Functions
+// Scalars are taken as std::type_identity_t so literals like 2 * v don't break deduction.
 
-inline std::ostream& operator<<(std::ostream& out, const Vector3& vector) {
+template <typename T>
+inline std::ostream& operator<<(std::ostream& out, const Vector3T<T>& vector) {
     return out << vector.points[0] << ' ' << vector.points[1] << ' ' << vector.points[2];
 }
 
-inline Vector3 operator+(const Vector3& u, const Vector3& v) {
-    return Vector3(u.points[0] + v.points[0], u.points[1] + v.points[1], u.points[2] + v.points[2]);
+template <typename T>
+inline Vector3T<T> operator+(const Vector3T<T>& u, const Vector3T<T>& v) {
+    return Vector3T<T>(u.points[0] + v.points[0], u.points[1] + v.points[1], u.points[2] + v.points[2]);
 }
 
-inline Vector3 operator-(const Vector3& u, const Vector3& v) {
-    return Vector3(u.points[0] - v.points[0], u.points[1] - v.points[1], u.points[2] - v.points[2]);
+template <typename T>
+inline Vector3T<T> operator-(const Vector3T<T>& u, const Vector3T<T>& v) {
+    return Vector3T<T>(u.points[0] - v.points[0], u.points[1] - v.points[1], u.points[2] - v.points[2]);
 }
 
-inline Vector3 operator*(const Vector3& u, const Vector3& v) {
-    return Vector3(u.points[0] * v.points[0], u.points[1] * v.points[1], u.points[2] * v.points[2]);
+template <typename T>
+inline Vector3T<T> operator*(const Vector3T<T>& u, const Vector3T<T>& v) {
+    return Vector3T<T>(u.points[0] * v.points[0], u.points[1] * v.points[1], u.points[2] * v.points[2]);
 }
 
-inline Vector3 operator*(double scalar, const Vector3& vector) {
-    return Vector3(scalar * vector.points[0], scalar * vector.points[1], scalar * vector.points[2]);
+template <typename T>
+inline Vector3T<T> operator*(std::type_identity_t<T> scalar, const Vector3T<T>& vector) {
+    return Vector3T<T>(scalar * vector.points[0], scalar * vector.points[1], scalar * vector.points[2]);
 }
 
-inline Vector3 operator*(const Vector3& v, double t) {
+template <typename T>
+inline Vector3T<T> operator*(const Vector3T<T>& v, std::type_identity_t<T> t) {
     return t * v;
 }
 
-inline Vector3 operator/(const Vector3& v, double t) {
+template <typename T>
+inline Vector3T<T> operator/(const Vector3T<T>& v, std::type_identity_t<T> t) {
     return (1 / t) * v;
 }
 
-inline double Dot(const Vector3& u, const Vector3& v) {
+template <typename T>
+inline T Dot(const Vector3T<T>& u, const Vector3T<T>& v) {
     return u.points[0] * v.points[0]
         + u.points[1] * v.points[1]
         + u.points[2] * v.points[2];
 }
 
-inline Vector3 Cross(const Vector3& u, const Vector3& v) {
-    return Vector3(u.points[1] * v.points[2] - u.points[2] * v.points[1],
+template <typename T>
+inline Vector3T<T> Cross(const Vector3T<T>& u, const Vector3T<T>& v) {
+    return Vector3T<T>(u.points[1] * v.points[2] - u.points[2] * v.points[1],
         u.points[2] * v.points[0] - u.points[0] * v.points[2],
         u.points[0] * v.points[1] - u.points[1] * v.points[0]);
 }
 
-inline Vector3 UnitVector(const Vector3& vector) {
+template <typename T>
+inline Vector3T<T> UnitVector(const Vector3T<T>& vector) {
     return vector / vector.Length();
 }
 
-inline Vector3 RandomUnitVector() {
+inline Vector3 RandomUnitVector(Rng& rng) {
     while (true) {
-        Vector3 p = Vector3::Random(-1, 1);
+        Vector3 p = Vector3::Random(rng, -1, 1);
         double lensq = p.LengthSquared();
         if (1e-160 < lensq && lensq <= 1) return p / sqrt(lensq);
     }
 }
 
-inline Vector3 RandomInUnitDisk() {
+inline Vector3 RandomInUnitDisk(Rng& rng) {
     while (true) {
-        Vector3 p = Vector3(RandomDouble(-1, 1), RandomDouble(-1, 1), 0);
+        double x = RandomDouble(rng, -1, 1);
+        Vector3 p = Vector3(x, RandomDouble(rng, -1, 1), 0);
         if (p.LengthSquared() < 1) return p;
     }
 }
 
-inline Vector3 RandomOnHemisphere(const Vector3& normal) {
-    Vector3 onUnitSphere = RandomUnitVector();
+inline Vector3 RandomOnHemisphere(Rng& rng, const Vector3& normal) {
+    Vector3 onUnitSphere = RandomUnitVector(rng);
     return (Dot(onUnitSphere, normal) > 0) ? onUnitSphere : -onUnitSphere;
 }
 
@@ -0,0 +1,423 @@
+#ifndef WIDE_BVH_H
+#define WIDE_BVH_H
+
+#include "BVH.h"
+
+#include <bit>
+#include <cfloat>
+#include <cstdint>
+#include <cstring>
+#include <vector>
+
+#if defined(__AVX2__)
+#include <immintrin.h>
+#endif
+
+// 8-wide BVH node with child boxes quantized to 8 bits against the node's own bounds (80 bytes,
+// versus 8 * 56 bytes for the binary nodes it replaces). Child box i on axis a spans
+// origin[a] + [qlo[a][i], qhi[a][i]] * 2^exponent[a], always rounded outward.
+struct alignas(16) WideBVHNode {
+    static constexpr int width = 8;
+
+    float origin[3];
+    int8_t exponent[3];
+    uint8_t internalMask;       // Bit i is set when child i is another wide node
+    uint32_t childBase;         // Index of the first interior child; the others follow it
+    uint32_t primitiveBase;     // Index of the first primitive of the first leaf child
+    uint8_t meta[width];        // Interior: offset from childBase. Leaf: count << 5 | offset from primitiveBase. Unused: 0
+    uint8_t qlo[3][width];
+    uint8_t qhi[3][width];
+};
+
+// Binary SAH tree collapsed into wide nodes. Traversal tests all eight children at once
+// (with AVX2 when the compiler targets it) and visits hit children nearest first.
+class WideBVH : public Hittable {
+public:
+    WideBVH(const HittableList& list, ThreadPool* pool = nullptr, Dispatch dispatch = Dispatch::ClosedWorld)
+        : WideBVH(list.objects, pool, dispatch) {}
+
+    WideBVH(const std::vector<shared_ptr<Hittable>>& sourceObjects, ThreadPool* pool = nullptr, Dispatch dispatch = Dispatch::ClosedWorld) {
+        std::vector<AABB> bounds;
+        bounds.reserve(sourceObjects.size());
+        for (const auto& object : sourceObjects)
+            bounds.push_back(object->BoundingBox());
+        if (bounds.empty()) return;
+
+        std::unique_ptr<ThreadPool> ownedPool;
+        if (!pool && sourceObjects.size() > 16 * 1024) {
+            ownedPool = std::make_unique<ThreadPool>();
+            pool = ownedPool.get();
+        }
+
+        std::vector<uint32_t> binaryOrder;
+        std::vector<BVHNode> binaryNodes = BVHBuilder::Build(bounds, binaryOrder, pool);
+        rootBounds = binaryNodes[0].bounds;
+
+        Collapser collapser{ binaryNodes, binaryOrder, bounds, nodes, order };
+        nodes.emplace_back();
+        collapser.Fill(0, { 0, 0, 0, false });
+
+        primitives.reserve(order.size());
+        for (uint32_t index : order)
+            primitives.emplace_back(sourceObjects[index], dispatch);
+    }
+
+    bool Hit(const Ray& ray, Interval rayT, HitRecord& record) const override {
+        TRACE_COUNT(hitCalls);
+        if (nodes.empty()) return false;
+
+        TraversalRay traversal(ray);
+        float tMin = float(rayT.min);
+        float tMax = RoundUp(rayT.max);
+
+        struct StackEntry {
+            uint32_t index;
+            uint32_t count; // 0 for wide nodes, otherwise a run of primitives
+            float entry;
+        };
+        StackEntry stack[maxStackSize];
+        int stackSize = 0;
+        stack[stackSize++] = { 0, 0, tMin };
+
+        bool hitAnything = false;
+        while (stackSize > 0) {
+            StackEntry current = stack[--stackSize];
+            if (current.entry > tMax) continue;
+
+            if (current.count > 0) {
+                for (uint32_t i = current.index; i < current.index + current.count; i++) {
+                    if (primitives[i].Hit(ray, rayT, record)) {
+                        hitAnything = true;
+                        rayT.max = record.t;
+                        tMax = RoundUp(record.t);
+                    }
+                }
+                continue;
+            }
+
+            TRACE_COUNT(nodesVisited);
+            const WideBVHNode& node = nodes[current.index];
+            float entries[WideBVHNode::width];
+            unsigned mask = IntersectChildren(node, traversal, tMin, tMax, entries) & ValidChildren(node);
+
+            // Gather hit children sorted far to near, so the nearest ends up on top of the stack
+            StackEntry hits[WideBVHNode::width];
+            int hitCount = 0;
+            while (mask) {
+                int child = std::countr_zero(mask);
+                mask &= mask - 1;
+
+                StackEntry entry;
+                uint8_t meta = node.meta[child];
+                if (node.internalMask & (1u << child))
+                    entry = { node.childBase + meta, 0, entries[child] };
+                else
+                    entry = { node.primitiveBase + (meta & 31u), uint32_t(meta >> 5), entries[child] };
+
+                int slot = hitCount++;
+                while (slot > 0 && hits[slot - 1].entry < entry.entry) {
+                    hits[slot] = hits[slot - 1];
+                    slot--;
+                }
+                hits[slot] = entry;
+            }
+            for (int i = 0; i < hitCount; i++)
+                stack[stackSize++] = hits[i];
+        }
+
+        return hitAnything;
+    }
+
+    void CollectLights(LightList& lights) const override {
+        for (const Primitive& primitive : primitives)
+            primitive.CollectLights(lights);
+    }
+
+    AABB BoundingBox() const override { return rootBounds; }
+
+    size_t NodeCount() const { return nodes.size(); }
+    size_t MemoryFootprint() const { return nodes.size() * sizeof(WideBVHNode); }
+
+private:
+    // Every wide level consumes at least one binary level and pushes at most 8 entries
+    static constexpr int maxStackSize = WideBVHNode::width * BVHBuilder::maxStackSize;
+    static constexpr int maxLeafSize = 4;
+
+    std::vector<WideBVHNode> nodes;
+    std::vector<uint32_t> order;
+    std::vector<Primitive> primitives;
+    AABB rootBounds;
+
+    struct TraversalRay {
+        float origin[3];
+        float inverseDirection[3];
+        bool negative[3];
+
+        TraversalRay(const Ray& ray) {
+            for (int axis = 0; axis < 3; axis++) {
+                double direction = ray.Direction()[axis];
+                // Keep zero components finite so the slab math never produces 0 * inf
+                if (std::fabs(direction) < 1e-20) direction = direction < 0 ? -1e-20 : 1e-20;
+                origin[axis] = float(ray.Origin()[axis]);
+                inverseDirection[axis] = float(1 / direction);
+                negative[axis] = direction < 0;
+            }
+        }
+    };
+
+    static float RoundUp(double value) {
+        float rounded = float(value);
+        return double(rounded) < value ? std::nextafter(rounded, FLT_MAX) : rounded;
+    }
+
+    static float RoundDown(double value) {
+        float rounded = float(value);
+        return double(rounded) > value ? std::nextafter(rounded, -FLT_MAX) : rounded;
+    }
+
+    // Builds 2^exponent directly from the float bit pattern; exponents are clamped to the normal range
+    static float PowerOfTwo(int8_t exponent) {
+        return std::bit_cast<float>(uint32_t(exponent + 127) << 23);
+    }
+
+    // The slots holding children: interior ones, and leaves, whose counts are never zero. Unused
+    // slots have inverted boxes too, but a ray can still pass those once the exit is padded, so
+    // traversal never relies on them missing.
+    static unsigned ValidChildren(const WideBVHNode& node) {
+        uint64_t meta;
+        std::memcpy(&meta, node.meta, sizeof(meta));
+        // Top bit of each byte set where the count bits are nonzero; no byte carries into the next
+        uint64_t counts = ((meta >> 5) & 0x0707070707070707ull) + 0x7f7f7f7f7f7f7f7full;
+        uint64_t leafBits = (counts & 0x8080808080808080ull) >> 7;
+        // Gathers bit 8i into bit 56 + i
+        unsigned leaves = unsigned((leafBits * 0x0102040810204080ull) >> 56);
+        return leaves | node.internalMask;
+    }
+
+    // Relative error of a float slab distance: the origin and direction conversions, the
+    // subtraction, the products and the sum each round once
+    static constexpr float slabError = 8 * FLT_EPSILON;
+
+    // An absolute bound on the error of every slab distance along one axis of a node, scaled by
+    // the terms the distances are computed from rather than by the distances, since a small one
+    // can be the difference of two large, inexact terms. Entries are moved nearer and exits
+    // farther by it, so the float ray never misses a box the double precision primitive test
+    // would hit; the smallest normal float keeps it from ever being zero.
+    static float SlabMargin(const WideBVHNode& node, const TraversalRay& ray, int axis, float slope, float offset) {
+        float terms = (std::fabs(node.origin[axis]) + std::fabs(ray.origin[axis])) * std::fabs(ray.inverseDirection[axis])
+            + std::fabs(offset) + 256 * std::fabs(slope);
+        return terms * slabError + FLT_MIN;
+    }
+
+    static unsigned IntersectChildren(const WideBVHNode& node, const TraversalRay& ray, float tMin, float tMax, float* entries) {
+#if defined(__AVX2__)
+        __m256 entry = _mm256_set1_ps(tMin);
+        __m256 exit = _mm256_set1_ps(tMax);
+
+        for (int axis = 0; axis < 3; axis++) {
+            // Which quantized bound is nearer depends only on the ray's direction sign
+            const uint8_t* nearBounds = ray.negative[axis] ? node.qhi[axis] : node.qlo[axis];
+            const uint8_t* farBounds = ray.negative[axis] ? node.qlo[axis] : node.qhi[axis];
+
+            float axisSlope = PowerOfTwo(node.exponent[axis]) * ray.inverseDirection[axis];
+            float axisOffset = (node.origin[axis] - ray.origin[axis]) * ray.inverseDirection[axis];
+            float margin = SlabMargin(node, ray, axis, axisSlope, axisOffset);
+            __m256 slope = _mm256_set1_ps(axisSlope);
+            __m256 nearOffset = _mm256_set1_ps(axisOffset - margin);
+            __m256 farOffset = _mm256_set1_ps(axisOffset + margin);
+
+            __m256 nearQuantized = _mm256_cvtepi32_ps(_mm256_cvtepu8_epi32(_mm_loadl_epi64(reinterpret_cast<const __m128i*>(nearBounds))));
+            __m256 farQuantized = _mm256_cvtepi32_ps(_mm256_cvtepu8_epi32(_mm_loadl_epi64(reinterpret_cast<const __m128i*>(farBounds))));
+
+#if defined(__FMA__) || defined(_MSC_VER)
+            __m256 nearT = _mm256_fmadd_ps(nearQuantized, slope, nearOffset);
+            __m256 farT = _mm256_fmadd_ps(farQuantized, slope, farOffset);
+#else
+            __m256 nearT = _mm256_add_ps(_mm256_mul_ps(nearQuantized, slope), nearOffset);
+            __m256 farT = _mm256_add_ps(_mm256_mul_ps(farQuantized, slope), farOffset);
+#endif
+            entry = _mm256_max_ps(entry, nearT);
+            exit = _mm256_min_ps(exit, farT);
+        }
+
+        _mm256_storeu_ps(entries, entry);
+        return unsigned(_mm256_movemask_ps(_mm256_cmp_ps(entry, exit, _CMP_LE_OQ)));
+#else
+        float exits[WideBVHNode::width];
+        for (int child = 0; child < WideBVHNode::width; child++) {
+            entries[child] = tMin;
+            exits[child] = tMax;
+        }
+
+        for (int axis = 0; axis < 3; axis++) {
+            const uint8_t* nearBounds = ray.negative[axis] ? node.qhi[axis] : node.qlo[axis];
+            const uint8_t* farBounds = ray.negative[axis] ? node.qlo[axis] : node.qhi[axis];
+            float slope = PowerOfTwo(node.exponent[axis]) * ray.inverseDirection[axis];
+            float offset = (node.origin[axis] - ray.origin[axis]) * ray.inverseDirection[axis];
+            float margin = SlabMargin(node, ray, axis, slope, offset);
+            float nearOffset = offset - margin, farOffset = offset + margin;
+
+            for (int child = 0; child < WideBVHNode::width; child++) {
+                float nearT = nearBounds[child] * slope + nearOffset;
+                float farT = farBounds[child] * slope + farOffset;
+                entries[child] = nearT > entries[child] ? nearT : entries[child];
+                exits[child] = farT < exits[child] ? farT : exits[child];
+            }
+        }
+
+        unsigned mask = 0;
+        for (int child = 0; child < WideBVHNode::width; child++) {
+            if (entries[child] <= exits[child]) mask |= 1u << child;
+        }
+        return mask;
+#endif
+    }
+
+    // Turns the binary tree into wide nodes by repeatedly opening the largest interior child
+    // until a node has eight children. Oversized binary leaves are opened into runs of at most
+    // maxLeafSize primitives so every leaf child fits the 3-bit count in its meta byte.
+    struct Collapser {
+        const std::vector<BVHNode>& binaryNodes;
+        const std::vector<uint32_t>& binaryOrder;
+        const std::vector<AABB>& primitiveBounds;
+        std::vector<WideBVHNode>& nodes;
+        std::vector<uint32_t>& order;
+
+        // Either a binary node or a run of primitives out of a binary leaf
+        struct Item {
+            uint32_t binaryIndex;
+            uint32_t begin, count;
+            bool isRange;
+        };
+
+        bool IsLeaf(const Item& item) const {
+            if (item.isRange) return item.count <= maxLeafSize;
+            const BVHNode& node = binaryNodes[item.binaryIndex];
+            return node.IsLeaf() && node.primitiveCount <= maxLeafSize;
+        }
+
+        AABB Bounds(const Item& item) const {
+            if (!item.isRange) return binaryNodes[item.binaryIndex].bounds;
+            AABB bounds;
+            for (uint32_t i = item.begin; i < item.begin + item.count; i++)
+                bounds = AABB(bounds, primitiveBounds[binaryOrder[i]]);
+            return bounds;
+        }
+
+        void Open(const Item& item, Item& first, Item& second) const {
+            if (!item.isRange && !binaryNodes[item.binaryIndex].IsLeaf()) {
+                const BVHNode& node = binaryNodes[item.binaryIndex];
+                first = { item.binaryIndex + 1, 0, 0, false };
+                second = { node.offset, 0, 0, false };
+                return;
+            }
+
+            uint32_t begin = item.isRange ? item.begin : binaryNodes[item.binaryIndex].offset;
+            uint32_t count = item.isRange ? item.count : binaryNodes[item.binaryIndex].primitiveCount;
+            first = { 0, begin, count / 2, true };
+            second = { 0, begin + count / 2, count - count / 2, true };
+        }
+
+        void Fill(uint32_t nodeIndex, const Item& item) {
+            Item children[WideBVHNode::width];
+            AABB childBounds[WideBVHNode::width];
+            int childCount = 0;
+
+            if (IsLeaf(item)) {
+                children[0] = item;
+                childCount = 1;
+            }
+            else {
+                Open(item, children[0], children[1]);
+                childCount = 2;
+            }
+
+            for (int i = 0; i < childCount; i++)
+                childBounds[i] = Bounds(children[i]);
+
+            while (childCount < WideBVHNode::width) {
+                int largest = -1;
+                double largestArea = -1;
+                for (int i = 0; i < childCount; i++) {
+                    double area = childBounds[i].SurfaceArea();
+                    if (!IsLeaf(children[i]) && area > largestArea) {
+                        largest = i;
+                        largestArea = area;
+                    }
+                }
+                if (largest < 0) break;
+
+                Item opened = children[largest];
+                Open(opened, children[largest], children[childCount]);
+                childBounds[largest] = Bounds(children[largest]);
+                childBounds[childCount] = Bounds(children[childCount]);
+                childCount++;
+            }
+
+            AABB bounds;
+            for (int i = 0; i < childCount; i++)
+                bounds = AABB(bounds, childBounds[i]);
+
+            WideBVHNode node = {};
+            Quantize(node, bounds, childBounds, childCount);
+
+            // Leaf children append their primitives; interior children get a contiguous block of nodes
+            node.primitiveBase = uint32_t(order.size());
+            node.childBase = uint32_t(nodes.size());
+            int interiorCount = 0;
+            for (int i = 0; i < childCount; i++) {
+                if (IsLeaf(children[i])) {
+                    uint32_t begin = children[i].isRange ? children[i].begin : binaryNodes[children[i].binaryIndex].offset;
+                    uint32_t count = children[i].isRange ? children[i].count : binaryNodes[children[i].binaryIndex].primitiveCount;
+                    node.meta[i] = uint8_t(count << 5 | (uint32_t(order.size()) - node.primitiveBase));
+                    for (uint32_t p = begin; p < begin + count; p++)
+                        order.push_back(binaryOrder[p]);
+                }
+                else {
+                    node.internalMask |= uint8_t(1u << i);
+                    node.meta[i] = uint8_t(interiorCount++);
+                }
+            }
+
+            nodes.resize(nodes.size() + interiorCount);
+            nodes[nodeIndex] = node;
+
+            for (int i = 0; i < childCount; i++) {
+                if (node.internalMask & (1u << i))
+                    Fill(node.childBase + node.meta[i], children[i]);
+            }
+        }
+
+        static void Quantize(WideBVHNode& node, const AABB& bounds, const AABB* childBounds, int childCount) {
+            for (int axis = 0; axis < 3; axis++) {
+                const Interval& extent = bounds.AxisInterval(axis);
+                float origin = RoundDown(extent.min);
+
+                // Smallest power of two step that still spans the node in 255 steps
+                int exponent = int(std::ceil(std::log2(std::fmax((extent.max - origin) / 255.0, 1e-30))));
+                exponent = exponent < -100 ? -100 : (exponent > 127 ? 127 : exponent);
+                double step = std::ldexp(1.0, exponent);
+
+                node.origin[axis] = origin;
+                node.exponent[axis] = int8_t(exponent);
+
+                for (int child = 0; child < WideBVHNode::width; child++) {
+                    if (child >= childCount) {
+                        // Inverted box so empty slots never report a hit
+                        node.qlo[axis][child] = 255;
+                        node.qhi[axis][child] = 0;
+                        continue;
+                    }
+
+                    const Interval& childExtent = childBounds[child].AxisInterval(axis);
+                    double low = std::floor((childExtent.min - origin) / step);
+                    double high = std::ceil((childExtent.max - origin) / step);
+                    node.qlo[axis][child] = uint8_t(low < 0 ? 0 : (low > 255 ? 255 : low));
+                    node.qhi[axis][child] = uint8_t(high < 0 ? 0 : (high > 255 ? 255 : high));
+                }
+            }
+        }
+    };
+};
+
+#endif